@@ -0,0 +1,121 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Small harness shared by the benchmarks. Each timed round gives one sample
+ * (ns per operation), results are summarized as mean and percentiles and
+ * printed as one JSON object per line so runs can be compared by scripts.
+ */
+
+typedef struct {
+  double *ns_op;
+  size_t count;
+  size_t size;
+} bench_samples_t;
+
+typedef struct {
+  double mean;
+  double min;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+} bench_summary_t;
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* resident set size now, in kB */
+static inline long bench_rss_kb(void) {
+  long pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%*s %ld", &pages) != 1) {
+      pages = 0;
+    }
+    fclose(fp);
+  }
+  return pages * (getpagesize() / 1024);
+}
+
+static inline void bench_samples_init(bench_samples_t *samples, size_t size) {
+  samples->ns_op = (double *)malloc(sizeof(*samples->ns_op) * size);
+  samples->count = 0;
+  samples->size = samples->ns_op ? size : 0;
+}
+
+static inline void bench_samples_free(bench_samples_t *samples) {
+  free(samples->ns_op);
+  samples->ns_op = NULL;
+  samples->count = samples->size = 0;
+}
+
+/* record a round of ops operations which took ns */
+static inline void bench_sample(bench_samples_t *samples, uint64_t ns,
+                                size_t ops) {
+  if (samples->count < samples->size && ops > 0) {
+    samples->ns_op[samples->count++] = (double)ns / (double)ops;
+  }
+}
+
+static int _bench_cmp(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* nearest rank percentile of sorted samples */
+static inline double _bench_rank(const bench_samples_t *samples, double p) {
+  size_t rank = (size_t)(p * (double)samples->count + 0.5);
+  if (rank > 0) {
+    rank--;
+  }
+  if (rank >= samples->count) {
+    rank = samples->count - 1;
+  }
+  return samples->ns_op[rank];
+}
+
+static inline bench_summary_t bench_summarize(bench_samples_t *samples) {
+  bench_summary_t summary = {0};
+  if (samples->count == 0) {
+    return summary;
+  }
+  qsort(samples->ns_op, samples->count, sizeof(*samples->ns_op), _bench_cmp);
+  double total = 0;
+  for (size_t i = 0; i < samples->count; i++) {
+    total += samples->ns_op[i];
+  }
+  summary.mean = total / (double)samples->count;
+  summary.min = samples->ns_op[0];
+  summary.p50 = _bench_rank(samples, 0.50);
+  summary.p90 = _bench_rank(samples, 0.90);
+  summary.p99 = _bench_rank(samples, 0.99);
+  summary.max = samples->ns_op[samples->count - 1];
+  return summary;
+}
+
+/* one JSON line per benchmark and allocator, rss_kb is what the resident size
+ * grew by during the run */
+static inline void bench_report(const char *bench, const char *allocator,
+                                int threads, size_t ops,
+                                bench_samples_t *samples, long rss_kb) {
+  bench_summary_t s = bench_summarize(samples);
+  printf("{\"bench\":\"%s\",\"allocator\":\"%s\",\"threads\":%d,"
+         "\"rounds\":%zu,\"ops\":%zu,\"ns_op\":%.2f,\"min\":%.2f,"
+         "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f,"
+         "\"rss_kb\":%ld}\n",
+         bench, allocator, threads, samples->count, ops, s.mean, s.min, s.p50,
+         s.p90, s.p99, s.max, rss_kb);
+  fflush(stdout);
+}
+
+#endif /* BENCH_H__ */
@@ -0,0 +1,90 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Throughput of many threads allocating from one MEM_ARENA_CONCURRENT arena,
+ * against the same threads each using their own arena. Every thread does the
+ * same amount of allocation, so with perfect scaling Mops/s grows with the
+ * thread count.
+ */
+
+#define OPS_PER_THREAD 50000
+#define ALLOC_SIZE 16
+#define MAX_THREADS 64
+
+struct job {
+  mem_arena_t *arena;
+  pthread_barrier_t *barrier;
+};
+
+static void *worker(void *arg) {
+  struct job *job = arg;
+  pthread_barrier_wait(job->barrier);
+  for (int i = 0; i < OPS_PER_THREAD; i++) {
+    void *ptr = mem_alloc(job->arena, ALLOC_SIZE);
+    if (ptr == NULL) {
+      abort();
+    }
+    *(volatile char *)ptr = (char)i;
+  }
+  return NULL;
+}
+
+/* run nthreads workers, with one shared arena or one arena each */
+static double run(int nthreads, mem_arena_t *shared, mem_arena_t **own) {
+  pthread_t threads[MAX_THREADS];
+  struct job jobs[MAX_THREADS];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  for (int i = 0; i < nthreads; i++) {
+    jobs[i].arena = shared ? shared : own[i];
+    jobs[i].barrier = &barrier;
+    pthread_create(&threads[i], NULL, worker, &jobs[i]);
+  }
+  pthread_barrier_wait(&barrier);
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  uint64_t ns = bench_now_ns() - start;
+  pthread_barrier_destroy(&barrier);
+  return (double)nthreads * OPS_PER_THREAD * 1000.0 / (double)ns;
+}
+
+int main(void) {
+  int counts[] = {1, 2, 4, 8, 16, 32, 64};
+  mem_arena_t *shared = mem_arena_new_flags(1024 * 1024, MEM_ARENA_CONCURRENT);
+  mem_arena_t *own[MAX_THREADS];
+  for (int i = 0; i < MAX_THREADS; i++) {
+    own[i] = mem_arena_new(1024 * 1024);
+  }
+
+  printf("%8s %18s %18s\n", "threads", "shared Mops/s", "per-thread Mops/s");
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    /* first run fills the regions, time the second one after a reset */
+    run(counts[i], shared, NULL);
+    mem_arena_reset(shared);
+    double shared_ops = run(counts[i], shared, NULL);
+    mem_arena_reset(shared);
+
+    run(counts[i], NULL, own);
+    for (int j = 0; j < counts[i]; j++) {
+      mem_arena_reset(own[j]);
+    }
+    double own_ops = run(counts[i], NULL, own);
+    for (int j = 0; j < counts[i]; j++) {
+      mem_arena_reset(own[j]);
+    }
+    printf("%8d %18.1f %18.1f\n", counts[i], shared_ops, own_ops);
+  }
+
+  mem_arena_destroy(shared);
+  for (int i = 0; i < MAX_THREADS; i++) {
+    mem_arena_destroy(own[i]);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Random reads over a buffer much bigger than the TLB reach, with regions
+ * backed by regular pages then by MEM_ARENA_HUGEPAGE ones. Each read is a
+ * likely TLB miss with 4 KiB pages, a lot less with 2 MiB ones.
+ */
+
+#define BUFFER_SIZE ((size_t)512 * 1024 * 1024)
+#define READS 20000000
+
+static double run(unsigned int flags) {
+  mem_arena_t *arena = mem_arena_new_flags(BUFFER_SIZE, flags);
+  if (arena == NULL) {
+    abort();
+  }
+  size_t count = BUFFER_SIZE / sizeof(uint64_t) - 1024;
+  uint64_t *buffer = mem_alloc(arena, count * sizeof(uint64_t));
+  if (buffer == NULL) {
+    abort();
+  }
+  for (size_t i = 0; i < count; i++) {
+    buffer[i] = i;
+  }
+
+  uint64_t x = 88172645463325252ull;
+  uint64_t sum = 0;
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < READS; i++) {
+    /* xorshift, cheap enough to not hide the memory access */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += buffer[x % count];
+  }
+  uint64_t ns = bench_now_ns() - start;
+  if (sum == 0) {
+    puts("");
+  }
+  mem_arena_destroy(arena);
+  return (double)ns / READS;
+}
+
+int main(void) {
+  printf("%12s %12s\n", "pages", "ns/read");
+  printf("%12s %12.2f\n", "regular", run(0));
+  printf("%12s %12.2f\n", "huge", run(MEM_ARENA_HUGEPAGE));
+  return EXIT_SUCCESS;
+}
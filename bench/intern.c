@@ -0,0 +1,77 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Tokenizer like stream of identifiers, most of them repeats, interned
+ * against duplicated with mem_strdup. Short (4 to 16) and long (64 to 256)
+ * keys are timed apart, rss_kb is replaced by the arena bytes used.
+ */
+
+#define ROUNDS 100
+#define TOKENS 16384
+#define DISTINCT 512
+
+static uint32_t next_rand(uint32_t *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return *seed >> 8;
+}
+
+static size_t used_bytes(mem_arena_t *arena) {
+  mem_arena_stats_t stats;
+  mem_arena_stats(arena, &stats);
+  return stats.used;
+}
+
+static void run(const char *bench, char **keys, size_t *lengths, int intern) {
+  mem_arena_t *arena = mem_arena_new(64 * 1024);
+  mem_intern_t table;
+  bench_samples_t samples;
+  bench_samples_init(&samples, ROUNDS);
+  uint32_t seed = 7;
+  size_t used = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    mem_intern_init(&table, arena);
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < TOKENS; i++) {
+      size_t k = next_rand(&seed) % DISTINCT;
+      const char *s = intern ? mem_intern_n(&table, keys[k], lengths[k])
+                             : mem_strndup(arena, keys[k], lengths[k]);
+      if (s == NULL) {
+        abort();
+      }
+    }
+    bench_sample(&samples, bench_now_ns() - start, TOKENS);
+    used = used_bytes(arena);
+    mem_arena_reset(arena);
+  }
+  bench_report(bench, intern ? "intern" : "strdup", 1, TOKENS, &samples,
+               (long)(used / 1024));
+  bench_samples_free(&samples);
+  mem_arena_destroy(arena);
+}
+
+int main(void) {
+  static char buffer[DISTINCT][257];
+  char *keys[DISTINCT];
+  size_t lengths[DISTINCT];
+  uint32_t seed = 42;
+  const char *names[] = {"short", "long"};
+  for (int l = 0; l < 2; l++) {
+    for (int i = 0; i < DISTINCT; i++) {
+      size_t len = l == 0 ? 4 + next_rand(&seed) % 13
+                          : 64 + next_rand(&seed) % 193;
+      for (size_t j = 0; j < len; j++) {
+        buffer[i][j] = (char)('a' + next_rand(&seed) % 26);
+      }
+      buffer[i][len] = '\0';
+      keys[i] = buffer[i];
+      lengths[i] = len;
+    }
+    run(names[l], keys, lengths, 1);
+    run(names[l], keys, lengths, 0);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#include "../src/include/memarena.hpp"
+#include "bench.h"
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory_resource>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* STL containers on an arena, through memarena::memory_resource and
+ * memarena::allocator, against the default (new/delete) resource. Each
+ * round fills a container then drops it, the arena is reset between rounds.
+ * Same JSON lines as workloads (see bench.h).
+ *
+ *   pmr [-r rounds] [bench...]
+ */
+
+#define ARENA_SIZE (64 * 1024)
+#define VECTOR_PUSH 16384
+#define MAP_INSERT 4096
+#define LIST_PUSH 4096
+
+template <class Vector> static std::size_t fill_vector(Vector &vector) {
+  for (int i = 0; i < VECTOR_PUSH; i++) {
+    vector.push_back(i);
+  }
+  return VECTOR_PUSH;
+}
+
+template <class Map> static std::size_t fill_map(Map &map) {
+  for (int i = 0; i < MAP_INSERT; i++) {
+    map.emplace(i * 7919, i);
+  }
+  return MAP_INSERT;
+}
+
+template <class List> static std::size_t fill_list(List &list) {
+  for (int i = 0; i < LIST_PUSH; i++) {
+    list.push_back(i);
+  }
+  return LIST_PUSH;
+}
+
+template <class Round>
+static void run(const char *bench, const char *allocator, std::size_t rounds,
+                mem_arena_t *arena, Round round) {
+  long rss = bench_rss_kb();
+  bench_samples_t samples;
+  bench_samples_init(&samples, rounds);
+  std::size_t ops = 0;
+  for (std::size_t i = 0; i < rounds + 4; i++) {
+    uint64_t start = bench_now_ns();
+    ops = round();
+    /* first rounds warm up */
+    if (i >= 4) {
+      bench_sample(&samples, bench_now_ns() - start, ops);
+    }
+    if (arena) {
+      mem_arena_reset(arena);
+    }
+  }
+  bench_report(bench, allocator, 1, ops, &samples, bench_rss_kb() - rss);
+  bench_samples_free(&samples);
+}
+
+template <class T> using arena_vector = std::vector<T, memarena::allocator<T>>;
+template <class K, class V>
+using arena_map =
+    std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+                       memarena::allocator<std::pair<const K, V>>>;
+template <class T> using arena_list = std::list<T, memarena::allocator<T>>;
+
+/* bench index for allocator index, in a child process */
+static void run_one(int bench, int allocator, std::size_t rounds) {
+  memarena::arena arena(ARENA_SIZE);
+  memarena::memory_resource resource(arena);
+  std::pmr::memory_resource *pmr = allocator == 0
+                                       ? std::pmr::get_default_resource()
+                                       : &resource;
+  const char *name = allocator == 0   ? "default"
+                     : allocator == 1 ? "memarena-pmr"
+                                      : "memarena-allocator";
+  mem_arena_t *reset = allocator == 0 ? nullptr : arena.get();
+
+  switch (bench) {
+  case 0:
+    if (allocator < 2) {
+      run("vector", name, rounds, reset, [&] {
+        std::pmr::vector<int> vector(pmr);
+        return fill_vector(vector);
+      });
+    } else {
+      run("vector", name, rounds, reset, [&] {
+        arena_vector<int> vector{memarena::allocator<int>(arena)};
+        return fill_vector(vector);
+      });
+    }
+    break;
+  case 1:
+    if (allocator < 2) {
+      run("unordered_map", name, rounds, reset, [&] {
+        std::pmr::unordered_map<int, int> map(pmr);
+        return fill_map(map);
+      });
+    } else {
+      run("unordered_map", name, rounds, reset, [&] {
+        arena_map<int, int> map{memarena::allocator<int>(arena)};
+        return fill_map(map);
+      });
+    }
+    break;
+  case 2:
+    if (allocator < 2) {
+      run("list", name, rounds, reset, [&] {
+        std::pmr::list<int> list(pmr);
+        return fill_list(list);
+      });
+    } else {
+      run("list", name, rounds, reset, [&] {
+        arena_list<int> list{memarena::allocator<int>(arena)};
+        return fill_list(list);
+      });
+    }
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *benches[] = {"vector", "unordered_map", "list"};
+  std::size_t rounds = 200;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    if (opt != 'r') {
+      std::fprintf(stderr, "usage: %s [-r rounds] [bench...]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    rounds = std::strtoul(optarg, nullptr, 10);
+  }
+  if (rounds == 0) {
+    return EXIT_FAILURE;
+  }
+
+  for (int b = 0; b < 3; b++) {
+    bool selected = optind == argc;
+    for (int i = optind; i < argc; i++) {
+      selected |= std::strcmp(argv[i], benches[b]) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+    for (int a = 0; a < 3; a++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        run_one(b, a, rounds);
+        std::exit(EXIT_SUCCESS);
+      }
+      int status = 0;
+      if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0) {
+        std::fprintf(stderr, "%s failed\n", benches[b]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
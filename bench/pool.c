@@ -0,0 +1,202 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Node churn: objects of one size with a window of live ones, a random one
+ * is freed and replaced at each step. mem_pool_t, with and without thread
+ * cache, against malloc. The threads bench shares one pool (concurrent
+ * arena) between the threads. Same JSON lines as workloads (see bench.h).
+ *
+ *   pool [-r rounds] [-t threads] [-s size] [bench...]
+ */
+
+#define CHURN_OPS 16384
+#define CHURN_WINDOW 1024
+#define WARMUP 4
+
+typedef struct {
+  const char *name;
+  unsigned int pool_flags; /* pools only */
+  int pool;
+} allocator_t;
+
+static const allocator_t allocators[] = {
+    {"mem_pool", 0, 1},
+    {"mem_pool-cache", MEM_POOL_THREAD_CACHE, 1},
+    {"malloc", 0, 0},
+};
+
+typedef struct {
+  mem_pool_t *pool;
+  size_t size;
+  size_t rounds;
+  uint32_t seed;
+  pthread_barrier_t *barrier;
+  bench_samples_t samples;
+} job_t;
+
+static uint32_t next_rand(uint32_t *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return *seed >> 8;
+}
+
+static void *checked(void *ptr) {
+  if (ptr == NULL) {
+    abort();
+  }
+  *(volatile char *)ptr = 1;
+  return ptr;
+}
+
+static void churn(job_t *job, void **live) {
+  for (size_t i = 0; i < CHURN_OPS; i++) {
+    void **slot = &live[next_rand(&job->seed) % CHURN_WINDOW];
+    if (job->pool) {
+      mem_pool_free(job->pool, *slot);
+      *slot = checked(mem_pool_alloc(job->pool));
+    } else {
+      free(*slot);
+      *slot = checked(malloc(job->size));
+    }
+  }
+}
+
+static void *run_job(void *arg) {
+  job_t *job = arg;
+  void **live = calloc(CHURN_WINDOW, sizeof(*live));
+  if (live == NULL) {
+    abort();
+  }
+  for (int i = 0; i < WARMUP; i++) {
+    churn(job, live);
+  }
+  if (job->barrier) {
+    pthread_barrier_wait(job->barrier);
+  }
+  for (size_t r = 0; r < job->rounds; r++) {
+    uint64_t start = bench_now_ns();
+    churn(job, live);
+    bench_sample(&job->samples, bench_now_ns() - start, CHURN_OPS);
+  }
+  for (size_t i = 0; i < CHURN_WINDOW; i++) {
+    if (job->pool) {
+      mem_pool_free(job->pool, live[i]);
+    } else {
+      free(live[i]);
+    }
+  }
+  free(live);
+  return NULL;
+}
+
+/* in a child process, so each run starts from the same resident size */
+static void run_bench(const char *bench, const allocator_t *allocator,
+                      size_t size, size_t rounds, int threads) {
+  long rss = bench_rss_kb();
+  mem_arena_t *arena = NULL;
+  mem_pool_t pool;
+  if (allocator->pool) {
+    arena = mem_arena_new_flags(64 * 1024,
+                                threads > 1 ? MEM_ARENA_CONCURRENT : 0);
+    if (arena == NULL) {
+      abort();
+    }
+    mem_pool_init(&pool, arena, size, 0, allocator->pool_flags);
+  }
+  job_t jobs[threads];
+  pthread_t tids[threads];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, threads);
+  for (int i = 0; i < threads; i++) {
+    jobs[i] = (job_t){arena ? &pool : NULL, size, rounds, 1234 + i,
+                      threads > 1 ? &barrier : NULL, {0}};
+    bench_samples_init(&jobs[i].samples, rounds);
+  }
+  if (threads == 1) {
+    run_job(&jobs[0]);
+  } else {
+    for (int i = 0; i < threads; i++) {
+      pthread_create(&tids[i], NULL, run_job, &jobs[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+      pthread_join(tids[i], NULL);
+    }
+  }
+  rss = bench_rss_kb() - rss;
+  bench_samples_t all;
+  bench_samples_init(&all, rounds * threads);
+  for (int i = 0; i < threads; i++) {
+    memcpy(all.ns_op + all.count, jobs[i].samples.ns_op,
+           sizeof(*all.ns_op) * jobs[i].samples.count);
+    all.count += jobs[i].samples.count;
+    bench_samples_free(&jobs[i].samples);
+  }
+  bench_report(bench, allocator->name, threads, CHURN_OPS, &all, rss);
+  bench_samples_free(&all);
+  pthread_barrier_destroy(&barrier);
+  mem_arena_destroy(arena);
+}
+
+int main(int argc, char **argv) {
+  const char *benches[] = {"churn", "threads"};
+  size_t rounds = 200;
+  size_t size = 64;
+  int threads = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:t:s:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-r rounds] [-t threads] [-s size] [bench...]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (rounds == 0 || threads < 1 || size == 0) {
+    return EXIT_FAILURE;
+  }
+
+  for (int b = 0; b < 2; b++) {
+    int selected = optind == argc;
+    for (int i = optind; i < argc; i++) {
+      selected |= strcmp(argv[i], benches[b]) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+      /* an uncached pool is for one thread */
+      if (b == 1 && allocators[a].pool && allocators[a].pool_flags == 0) {
+        continue;
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+        run_bench(benches[b], &allocators[a], size, rounds,
+                  b == 1 ? threads : 1);
+        exit(EXIT_SUCCESS);
+      }
+      int status = 0;
+      if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s/%s failed\n", benches[b], allocators[a].name);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
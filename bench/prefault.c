@@ -0,0 +1,101 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Latency of an allocation plus its first write, timed one by one on a
+ * fresh arena, so first touch page faults show in the percentiles. The
+ * arena is lazily mapped, populated at mapping, prefaulted ahead of the bump
+ * or prewarmed before the run. Same JSON lines as workloads (see bench.h),
+ * rss_kb is what the arena grew the resident size by.
+ *
+ *   prefault [-n allocations] [-s size]
+ */
+
+#define ARENA_SIZE (4 * 1024 * 1024)
+#define PREFAULT_AHEAD (256 * 1024)
+
+typedef struct {
+  const char *name;
+  unsigned int flags;
+  size_t prefault;
+  int prewarm;
+} config_t;
+
+static const config_t configs[] = {
+    {"lazy", 0, 0, 0},
+    {"populate", MEM_ARENA_POPULATE, 0, 0},
+    {"prefault", 0, PREFAULT_AHEAD, 0},
+    {"prewarm", 0, 0, 1},
+};
+
+/* in a child process, so the resident size is its own */
+static void run(const config_t *config, size_t count, size_t size) {
+  long rss = bench_rss_kb();
+  mem_arena_t *arena = mem_arena_new_flags(ARENA_SIZE, config->flags);
+  if (arena == NULL) {
+    abort();
+  }
+  if (config->prefault) {
+    mem_arena_set_prefault(arena, config->prefault);
+  }
+  if (config->prewarm && mem_arena_prewarm(arena, count * (size + 64)) != 0) {
+    abort();
+  }
+  bench_samples_t samples;
+  bench_samples_init(&samples, count);
+  for (size_t i = 0; i < count; i++) {
+    uint64_t start = bench_now_ns();
+    char *ptr = mem_alloc(arena, size);
+    if (ptr == NULL) {
+      abort();
+    }
+    ptr[0] = 1;
+    bench_sample(&samples, bench_now_ns() - start, 1);
+  }
+  bench_report("alloc-first-write", config->name, 1, count, &samples,
+               bench_rss_kb() - rss);
+  bench_samples_free(&samples);
+  mem_arena_destroy(arena);
+}
+
+int main(int argc, char **argv) {
+  size_t count = 65536;
+  size_t size = 512;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+    case 'n':
+      count = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n allocations] [-s size]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (count == 0 || size == 0) {
+    return EXIT_FAILURE;
+  }
+
+  for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      run(&configs[c], count, size);
+      exit(EXIT_SUCCESS);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s failed\n", configs[c].name);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Allocation latency against the number of empty regions queued after tail.
+ * Small regions are filled then emptied with mem_free, so they wait after the
+ * tail, followed by one emptied region big enough for the timed request. The
+ * request must find that region without going through the small ones, so the
+ * latency should stay flat as the region count grows. Each round builds a
+ * fresh arena and times that one request. As built, more regions leave less
+ * of the touched headers in the caches and TLB, so it's also timed with the
+ * caches flushed first: the cost of the lookup itself, whatever the count.
+ * Same JSON lines as workloads (see bench.h) with one bench per region
+ * count, rss_kb is left to 0.
+ *
+ *   regions [-r rounds]
+ */
+
+#define WARMUP 4
+/* more than the last level cache and the TLB reach */
+#define FLUSH_SIZE (128 * 1024 * 1024)
+
+static volatile char *flush_buffer;
+
+static void flush_caches(void) {
+  for (size_t i = 0; i < FLUSH_SIZE; i += 64) {
+    flush_buffer[i]++;
+  }
+}
+
+static uint64_t time_big_alloc(size_t count, int cold) {
+  size_t ps = getpagesize();
+  mem_arena_t *arena = mem_arena_new(ps);
+  void **small = malloc(sizeof(*small) * count * 4);
+  size_t n = 0;
+  size_t regions = 1;
+  while (regions < count) {
+    mem_arena_region_t *tail = arena->tail;
+    small[n] = mem_alloc(arena, ps / 2);
+    if (small[n++] == NULL) {
+      abort();
+    }
+    if (arena->tail != tail) {
+      regions++;
+    }
+  }
+
+  void *big = mem_alloc(arena, ps * 8);
+  /* second big one so the first is not tail anymore */
+  if (big == NULL || mem_alloc(arena, ps * 8) == NULL) {
+    abort();
+  }
+  for (size_t i = 0; i < n; i++) {
+    mem_free(arena, small[i]);
+  }
+  mem_free(arena, big);
+  if (cold) {
+    flush_caches();
+  }
+
+  uint64_t start = bench_now_ns();
+  void *ptr = mem_alloc(arena, ps * 8);
+  uint64_t ns = bench_now_ns() - start;
+  if (ptr != big) {
+    abort();
+  }
+
+  free(small);
+  mem_arena_destroy(arena);
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  size_t counts[] = {1, 16, 256, 1024, 4096, 16384};
+  size_t rounds = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r rounds]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  flush_buffer = malloc(FLUSH_SIZE);
+  if (rounds == 0 || flush_buffer == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  for (int cold = 0; cold < 2; cold++) {
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+      char bench[32];
+      snprintf(bench, sizeof(bench), "regions-%zu%s", counts[i],
+               cold ? "-cold" : "");
+      for (int j = 0; j < WARMUP; j++) {
+        time_big_alloc(counts[i], cold);
+      }
+      bench_samples_t samples;
+      bench_samples_init(&samples, rounds);
+      for (size_t j = 0; j < rounds; j++) {
+        bench_sample(&samples, time_big_alloc(counts[i], cold), 1);
+      }
+      bench_report(bench, "mem_alloc", 1, 1, &samples, 0);
+      bench_samples_free(&samples);
+    }
+  }
+  free((void *)flush_buffer);
+  return EXIT_SUCCESS;
+}
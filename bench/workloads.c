@@ -0,0 +1,351 @@
+#include "../src/include/memarena.h"
+#include "bench.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Allocation workloads run against memarena and malloc. Each benchmark and
+ * allocator pair runs in its own process so the resident size is its own,
+ * and prints one JSON line (see bench.h).
+ *
+ *   workloads [-r rounds] [-t threads] [bench...]
+ */
+
+#define ARENA_SIZE (64 * 1024)
+#define MAX_PTRS 8192
+#define WARMUP 4
+
+typedef struct {
+  const char *name;
+  void *(*create)(void);
+  void (*destroy)(void *ctx);
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t size);
+  void (*free)(void *ctx, void *ptr);
+  char *(*strdup)(void *ctx, const char *string);
+  /* drop every allocation of the round, arena just resets */
+  void (*release)(void *ctx, void **ptrs, size_t count);
+} allocator_t;
+
+typedef struct {
+  const allocator_t *allocator;
+  void *ctx;
+  void **ptrs;
+  uint32_t seed;
+} round_t;
+
+typedef struct {
+  const char *name;
+  /* run one round, returns the number of operations */
+  size_t (*run)(round_t *round);
+  int threaded;
+} workload_t;
+
+/* *** Allocators *** */
+
+static void *arena_create(void) { return mem_arena_new(ARENA_SIZE); }
+static void *arena_create_freelist(void) {
+  return mem_arena_new_flags(ARENA_SIZE, MEM_ARENA_FREELIST);
+}
+static void arena_destroy(void *ctx) { mem_arena_destroy(ctx); }
+static void *arena_alloc(void *ctx, size_t size) {
+  return mem_alloc(ctx, size);
+}
+static void *arena_alloc_inline(void *ctx, size_t size) {
+  return mem_alloc_inline(ctx, size);
+}
+static void *arena_realloc(void *ctx, void *ptr, size_t size) {
+  return mem_realloc(ctx, ptr, size);
+}
+static void arena_free(void *ctx, void *ptr) { mem_free(ctx, ptr); }
+static char *arena_strdup(void *ctx, const char *string) {
+  return mem_strdup(ctx, string);
+}
+static void arena_release(void *ctx, void **ptrs, size_t count) {
+  mem_arena_reset(ctx);
+  memset(ptrs, 0, sizeof(*ptrs) * count);
+}
+
+static void *libc_create(void) { return NULL; }
+static void libc_destroy(void *ctx) {}
+static void *libc_alloc(void *ctx, size_t size) { return malloc(size); }
+static void *libc_realloc(void *ctx, void *ptr, size_t size) {
+  return realloc(ptr, size);
+}
+static void libc_free(void *ctx, void *ptr) { free(ptr); }
+static char *libc_strdup(void *ctx, const char *string) {
+  return strdup(string);
+}
+static void libc_release(void *ctx, void **ptrs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(ptrs[i]);
+    ptrs[i] = NULL;
+  }
+}
+
+static const allocator_t allocators[] = {
+    {"memarena", arena_create, arena_destroy, arena_alloc, arena_realloc,
+     arena_free, arena_strdup, arena_release},
+    {"memarena-inline", arena_create, arena_destroy, arena_alloc_inline,
+     arena_realloc, arena_free, arena_strdup, arena_release},
+    {"memarena-freelist", arena_create_freelist, arena_destroy, arena_alloc,
+     arena_realloc, arena_free, arena_strdup, arena_release},
+    {"malloc", libc_create, libc_destroy, libc_alloc, libc_realloc, libc_free,
+     libc_strdup, libc_release},
+};
+
+/* *** Workloads *** */
+
+static uint32_t next_rand(uint32_t *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return *seed >> 8;
+}
+
+static void *checked(void *ptr) {
+  if (ptr == NULL) {
+    abort();
+  }
+  /* touch it, as any user would */
+  *(volatile char *)ptr = 1;
+  return ptr;
+}
+
+/* small objects with a sliding window of live ones, the oldest is freed */
+#define CHURN_OPS 4096
+#define CHURN_WINDOW 64
+static size_t run_churn(round_t *r) {
+  const allocator_t *a = r->allocator;
+  for (size_t i = 0; i < CHURN_OPS; i++) {
+    void **slot = &r->ptrs[i % CHURN_WINDOW];
+    if (*slot) {
+      a->free(r->ctx, *slot);
+    }
+    *slot = checked(a->alloc(r->ctx, 16 + next_rand(&r->seed) % 240));
+  }
+  a->release(r->ctx, r->ptrs, CHURN_WINDOW);
+  return CHURN_OPS;
+}
+
+/* dynamic array of int, capacity doubled with realloc when full */
+#define GROWTH_PUSH 16384
+static size_t run_realloc(round_t *r) {
+  const allocator_t *a = r->allocator;
+  size_t capacity = 4;
+  int *array = checked(a->alloc(r->ctx, capacity * sizeof(*array)));
+  for (size_t i = 0; i < GROWTH_PUSH; i++) {
+    if (i == capacity) {
+      capacity *= 2;
+      array = checked(a->realloc(r->ctx, array, capacity * sizeof(*array)));
+    }
+    array[i] = (int)i;
+  }
+  r->ptrs[0] = array;
+  a->release(r->ctx, r->ptrs, 1);
+  return GROWTH_PUSH;
+}
+
+/* duplicate strings of 4 to 67 characters */
+#define STRDUP_OPS 4096
+#define STRDUP_POOL 256
+static char strings[STRDUP_POOL][68];
+static size_t run_strdup(round_t *r) {
+  const allocator_t *a = r->allocator;
+  for (size_t i = 0; i < STRDUP_OPS; i++) {
+    r->ptrs[i] = checked(a->strdup(r->ctx, strings[i % STRDUP_POOL]));
+  }
+  a->release(r->ctx, r->ptrs, STRDUP_OPS);
+  return STRDUP_OPS;
+}
+
+/* request like cycles, allocate a batch then drop it all at once */
+#define RESET_CYCLES 16
+#define RESET_BATCH 512
+static size_t run_reset(round_t *r) {
+  const allocator_t *a = r->allocator;
+  for (size_t c = 0; c < RESET_CYCLES; c++) {
+    for (size_t i = 0; i < RESET_BATCH; i++) {
+      r->ptrs[i] = checked(a->alloc(r->ctx, 8 + next_rand(&r->seed) % 504));
+    }
+    a->release(r->ctx, r->ptrs, RESET_BATCH);
+  }
+  return RESET_CYCLES * RESET_BATCH;
+}
+
+/* every allocation freed on its own, in random order */
+#define FREE_COUNT 4096
+static size_t run_free(round_t *r) {
+  const allocator_t *a = r->allocator;
+  for (size_t i = 0; i < FREE_COUNT; i++) {
+    r->ptrs[i] = checked(a->alloc(r->ctx, 32 + next_rand(&r->seed) % 96));
+  }
+  for (size_t i = FREE_COUNT - 1; i > 0; i--) {
+    size_t j = next_rand(&r->seed) % (i + 1);
+    void *tmp = r->ptrs[i];
+    r->ptrs[i] = r->ptrs[j];
+    r->ptrs[j] = tmp;
+  }
+  for (size_t i = 0; i < FREE_COUNT; i++) {
+    a->free(r->ctx, r->ptrs[i]);
+    r->ptrs[i] = NULL;
+  }
+  a->release(r->ctx, r->ptrs, 0);
+  return FREE_COUNT * 2;
+}
+
+static const workload_t workloads[] = {
+    {"churn", run_churn, 0},   {"realloc", run_realloc, 0},
+    {"strdup", run_strdup, 0}, {"reset", run_reset, 0},
+    {"free", run_free, 0},     {"threads", run_churn, 1},
+};
+
+/* *** Driver *** */
+
+typedef struct {
+  const allocator_t *allocator;
+  const workload_t *workload;
+  size_t rounds;
+  size_t ops;
+  uint32_t seed;
+  void *ctx;
+  pthread_barrier_t *barrier;
+  bench_samples_t samples;
+} job_t;
+
+static void *run_job(void *arg) {
+  job_t *job = arg;
+  void **ptrs = calloc(MAX_PTRS, sizeof(*ptrs));
+  job->ctx = job->allocator->create();
+  round_t round = {job->allocator, job->ctx, ptrs, job->seed};
+  /* a failed arena creation aborts on first allocation */
+  if (ptrs == NULL) {
+    abort();
+  }
+  for (int i = 0; i < WARMUP; i++) {
+    job->workload->run(&round);
+  }
+  if (job->barrier) {
+    pthread_barrier_wait(job->barrier);
+  }
+  for (size_t i = 0; i < job->rounds; i++) {
+    uint64_t start = bench_now_ns();
+    job->ops = job->workload->run(&round);
+    bench_sample(&job->samples, bench_now_ns() - start, job->ops);
+  }
+  free(ptrs);
+  return NULL;
+}
+
+/* in a child process, so each run starts from the same resident size */
+static void run_bench(const workload_t *workload, const allocator_t *allocator,
+                      size_t rounds, int threads) {
+  if (!workload->threaded) {
+    threads = 1;
+  }
+  long rss = bench_rss_kb();
+  job_t jobs[threads];
+  pthread_t tids[threads];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, threads);
+  for (int i = 0; i < threads; i++) {
+    jobs[i] = (job_t){allocator, workload, rounds, 0, 1234 + i, NULL,
+                      threads > 1 ? &barrier : NULL, {0}};
+    bench_samples_init(&jobs[i].samples, rounds);
+  }
+  if (threads == 1) {
+    run_job(&jobs[0]);
+  } else {
+    for (int i = 0; i < threads; i++) {
+      pthread_create(&tids[i], NULL, run_job, &jobs[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+      pthread_join(tids[i], NULL);
+    }
+  }
+  /* measured before anything is given back */
+  rss = bench_rss_kb() - rss;
+  for (int i = 0; i < threads; i++) {
+    allocator->destroy(jobs[i].ctx);
+  }
+  /* every thread sample counts */
+  bench_samples_t all;
+  bench_samples_init(&all, rounds * threads);
+  for (int i = 0; i < threads; i++) {
+    memcpy(all.ns_op + all.count, jobs[i].samples.ns_op,
+           sizeof(*all.ns_op) * jobs[i].samples.count);
+    all.count += jobs[i].samples.count;
+    bench_samples_free(&jobs[i].samples);
+  }
+  bench_report(workload->name, allocator->name, threads, jobs[0].ops, &all,
+               rss);
+  bench_samples_free(&all);
+  pthread_barrier_destroy(&barrier);
+}
+
+static int selected(const char *name, int argc, char **argv) {
+  if (argc == 0) {
+    return 1;
+  }
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t rounds = 200;
+  int threads = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r rounds] [-t threads] [bench...]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (rounds == 0 || threads < 1) {
+    return EXIT_FAILURE;
+  }
+
+  uint32_t seed = 42;
+  for (size_t i = 0; i < STRDUP_POOL; i++) {
+    size_t len = 4 + next_rand(&seed) % 64;
+    for (size_t j = 0; j < len; j++) {
+      strings[i][j] = (char)('a' + next_rand(&seed) % 26);
+    }
+    strings[i][len] = '\0';
+  }
+
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+    if (!selected(workloads[w].name, argc - optind, argv + optind)) {
+      continue;
+    }
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        run_bench(&workloads[w], &allocators[a], rounds, threads);
+        exit(EXIT_SUCCESS);
+      }
+      int status = 0;
+      if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s/%s failed\n", workloads[w].name,
+                allocators[a].name);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
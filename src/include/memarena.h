@@ -6,7 +6,77 @@
 #define MEMARENA_ALIGNMENT sizeof(max_align_t)
 #endif /* MEMARENA_ALIGNMENT */
 
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#ifndef MEMARENA_SCRATCH_SIZE
+#define MEMARENA_SCRATCH_SIZE (64 * 1024)
+#endif /* MEMARENA_SCRATCH_SIZE */
+/* huge page size used by MEM_ARENA_HUGEPAGE arenas */
+#ifndef MEMARENA_HUGEPAGE_SIZE
+#define MEMARENA_HUGEPAGE_SIZE (2 * 1024 * 1024)
+#endif /* MEMARENA_HUGEPAGE_SIZE */
+/* default byte limit of the process wide region cache, 0 disables it */
+#ifndef MEMARENA_REGION_CACHE_LIMIT
+#define MEMARENA_REGION_CACHE_LIMIT 0
+#endif /* MEMARENA_REGION_CACHE_LIMIT */
+/* number of scratch arenas per thread */
+#define MEMARENA_SCRATCH_COUNT 2
+/* nested scratch scopes rewound on their own, deeper ones end with their
+ * parent */
+#ifndef MEMARENA_SCRATCH_DEPTH
+#define MEMARENA_SCRATCH_DEPTH 16
+#endif /* MEMARENA_SCRATCH_DEPTH */
+
+/* arena flags */
+/* many threads can allocate from the arena at the same time */
+#define MEM_ARENA_CONCURRENT 0x1
+/* regions are backed by huge pages */
+#define MEM_ARENA_HUGEPAGE 0x2
+/* mem_free puts blocks on size class free lists reused by mem_alloc */
+#define MEM_ARENA_FREELIST 0x4
+/* regions are populated (MAP_POPULATE) when mapped, no fault on first use */
+#define MEM_ARENA_POPULATE 0x8
+
+/* mem_intern_init_flags flags */
+/* the table survives resets, it allocates in an arena of its own */
+#define MEM_INTERN_PERSISTENT 0x1
+
+/* mem_pool_init flags */
+/* pool shared by threads, each keeping a cache of free objects */
+#define MEM_POOL_THREAD_CACHE 0x1
+
+/* trim policy flags, see mem_arena_set_trim */
+/* use MADV_FREE instead of MADV_DONTNEED, pages are taken back lazily */
+#define MEM_TRIM_FREE 0x1
+/* unmap the regions above the kept size instead of advising them */
+#define MEM_TRIM_UNMAP 0x2
+
+/* size rounded up to the alignment, and size of the header stored before each
+ * block, see mem_alloc_inline */
+#define MEMARENA_ALIGNED_SIZE(x)                                               \
+  ((((x) + (MEMARENA_ALIGNMENT - 1)) / MEMARENA_ALIGNMENT) * MEMARENA_ALIGNMENT)
+#define MEMARENA_HEADER_SIZE MEMARENA_ALIGNED_SIZE(sizeof(mem_arena_block_t))
+
+/* number of free space bins, one per power of two */
+#define MEMARENA_BINS (sizeof(size_t) * 8)
+/* bytes carved at once by a mem_pool_t, at least one object */
+#ifndef MEMARENA_POOL_SLAB
+#define MEMARENA_POOL_SLAB 16384
+#endif /* MEMARENA_POOL_SLAB */
+/* MEM_ARENA_FREELIST exact size classes, one per multiple of the alignment,
+ * bigger blocks are listed by power of two */
+#ifndef MEMARENA_FREELIST_SMALL
+#define MEMARENA_FREELIST_SMALL 16
+#endif /* MEMARENA_FREELIST_SMALL */
+/* allocation size classes of the stats histogram, class i counts sizes in
+ * [2^i, 2^(i+1)), the last one everything above */
+#define MEMARENA_STATS_CLASSES 16
 
 /* bump arena using mmap for block */
 typedef struct {
@@ -16,15 +86,163 @@ typedef struct {
   size_t capacity;
   size_t used;
   void *next;
+  void *prev;
+  /* empty regions waiting after tail are kept in bins by capacity */
+  int bin;
+  void *bin_next;
+  void *bin_prev;
+  /* how the region memory is backed */
+  unsigned int flags;
+  /* unique, unlike the address which can change with mremap, a new one is
+   * given when an emptied region is reused */
+  size_t id;
+  /* data bytes populated by prefaulting, see mem_arena_set_prefault */
+  size_t prefaulted;
+  /* highest used seen before it went down, data above it and above used was
+   * never handed out and is still zero from mmap, see mem_calloc */
+  size_t dirty;
 } mem_arena_region_t;
 
+/* header stored right before each pointer returned by mem_alloc, it keeps the
+ * size and a back reference to the owning region so we never have to search
+ * the region chain */
+typedef struct {
+  size_t size;
+  mem_arena_region_t *region;
+} mem_arena_block_t;
+
+/* arena statistics, see mem_arena_stats. Counters are kept unless the
+ * library is built with MEMARENA_NO_STATS, they are then left to 0 */
 typedef struct {
+  /* computed when the snapshot is taken */
+  size_t regions;
+  size_t mapped;   /* bytes mapped, region and arena structures included */
+  size_t capacity; /* bytes available for allocation */
+  size_t used;     /* bytes allocated, headers and padding included */
+  /* counted since arena creation */
+  size_t peak;      /* highest used */
+  size_t requested; /* bytes asked by allocations */
+  size_t overhead;  /* header and alignment bytes added to them */
+  size_t allocs;
+  size_t frees;
+  size_t reuses; /* allocations served by the free lists */
+  size_t reallocs;
+  size_t reallocs_inplace; /* grown or shrunk without moving */
+  size_t reallocs_remap;   /* grown by remapping the region */
+  size_t reallocs_copy;    /* moved to a new block */
+  size_t mmaps;            /* regions mapped, not taken from the cache */
+  size_t histogram[MEMARENA_STATS_CLASSES];
+} mem_arena_stats_t;
+
+typedef struct mem_arena_s mem_arena_t;
+
+/* growth callback, gives the size of the next new region, need is the
+ * minimum the region must hold */
+typedef size_t (*mem_arena_growth_fn)(const mem_arena_t *arena, size_t need,
+                                      void *data);
+
+struct mem_arena_s {
   size_t pagesize;
   size_t default_size;
   size_t embed;
+  unsigned int flags;
+  /* child arena, its regions are blocks of parent */
+  mem_arena_t *parent;
+  /* incremented by each reset, structures built on the arena compare it to
+   * know their memory is gone */
+  size_t generation;
+  /* mem_arena_reset_trim settings and decaying high water mark */
+  size_t trim_retain;
+  unsigned int trim_policy;
+  size_t high_water;
+  /* bytes populated ahead of the bump, 0 when not prefaulting, see
+   * mem_arena_set_prefault */
+  size_t prefault_ahead;
+  /* region growth policy, next_size is the size of the next new region */
+  unsigned int growth_factor;
+  size_t growth_max;
+  size_t next_size;
+  mem_arena_growth_fn growth_fn;
+  void *growth_data;
   mem_arena_region_t *head;
   mem_arena_region_t *tail;
-} mem_arena_t;
+  mem_arena_region_t *last;
+  /* bin i holds empty regions with capacity in [2^i, 2^(i+1)), bin_mask has
+   * bit i set when bin i is not empty */
+  size_t bin_mask;
+  mem_arena_region_t *bins[MEMARENA_BINS];
+  /* MEM_ARENA_FREELIST freed blocks, linked through their first word. Small
+   * ones by exact size, others in [2^i, 2^(i+1)) with bit i of free_mask set
+   * when list i is not empty */
+  void *free_small[MEMARENA_FREELIST_SMALL];
+  void *free_large[MEMARENA_BINS];
+  size_t free_mask;
+  /* counters, used is kept up to date for peak */
+  mem_arena_stats_t stats;
+};
+
+/* growable array, see mem_vec_init */
+typedef struct {
+  mem_arena_t *arena;
+  void *data;
+  size_t length;     /* in elements */
+  size_t capacity;   /* in elements */
+  size_t elem_size;
+  size_t generation; /* arena generation data was allocated in */
+} mem_vec_t;
+
+/* string builder, see mem_str_init. The string is always NUL terminated,
+ * vec length doesn't count the NUL */
+typedef struct {
+  mem_vec_t vec;
+} mem_str_t;
+
+/* string interning table, see mem_intern_init */
+typedef struct {
+  const char *string; /* NULL for an empty bucket */
+  uint32_t hash;
+  uint32_t length;
+} mem_intern_entry_t;
+
+typedef struct {
+  mem_arena_t *arena;
+  mem_intern_entry_t *buckets; /* open addressing, linear probing */
+  size_t capacity;             /* power of two */
+  size_t count;
+  size_t generation; /* arena generation buckets were allocated in */
+  unsigned int flags;
+} mem_intern_t;
+
+/* fixed size object pool, see mem_pool_init */
+typedef struct {
+  mem_arena_t *arena;
+  void *free;               /* freed objects, linked through their first word */
+  unsigned char *slab;      /* next object never handed out */
+  unsigned char *slab_end;
+  size_t object_size;       /* rounded up to align */
+  size_t align;
+  size_t generation;        /* arena generation the slabs were allocated in */
+  size_t id;                /* thread cache key */
+  unsigned int flags;
+  int lock;                 /* with MEM_POOL_THREAD_CACHE */
+} mem_pool_t;
+
+/* savepoint, see mem_arena_mark */
+typedef struct {
+  mem_arena_region_t *region;
+  size_t region_id;
+  size_t used;
+  int alloc_cnt;
+  size_t last_alloc; /* offset in region data, 0 for none */
+} mem_arena_mark_t;
+
+typedef struct {
+  size_t limit;
+  size_t bytes;
+  size_t regions;
+  size_t hits;
+  size_t misses;
+} mem_region_cache_stats_t;
 
 /* *** Arena init and destroy *** */
 /**
@@ -42,6 +260,43 @@ typedef struct {
  */
 mem_arena_t *mem_arena_new(size_t size);
 
+/**
+ * Create a new arena with flags.
+ *
+ * Same as mem_arena_new with some MEM_ARENA_* flags.
+ *
+ * With MEM_ARENA_CONCURRENT, mem_alloc, mem_alloc_nohdr and the functions
+ * built on them (strdup, memdup, realloc by copy) can be called from many
+ * threads at once. The bump is an atomic fetch add on the tail region and new
+ * regions are published with compare and swap. In that mode mem_free does
+ * nothing and mem_realloc never grows in place. mem_arena_reset and
+ * mem_arena_destroy must still be called by a single owner, with no
+ * allocation running.
+ *
+ * With MEM_ARENA_FREELIST, a block freed in the middle of a region goes on a
+ * free list of its size class, reused by the next mem_alloc of that size
+ * before bumping. Blocks keep their region busy while listed. The lists are
+ * dropped by mem_arena_reset and mem_arena_rewind. Ignored for concurrent
+ * arenas.
+ *
+ * With MEM_ARENA_POPULATE, regions are populated when mapped (MAP_POPULATE),
+ * or when taken from the region cache, so their pages don't fault on first
+ * write. It moves the cost to region creation, see also
+ * mem_arena_set_prefault and mem_arena_prewarm.
+ *
+ * With MEM_ARENA_HUGEPAGE, regions are made of MEMARENA_HUGEPAGE_SIZE pages,
+ * the arena pagesize and default region size are rounded to it. Reserved huge
+ * pages (MAP_HUGETLB) are used when available, otherwise regions are aligned
+ * on huge page size and advised with MADV_HUGEPAGE for transparent huge pages.
+ *
+ * \param[in] size   Memory region will be allocated of that size. If 0 it
+ *                   uses getpagesize().
+ * \param[in] flags  MEM_ARENA_* flags
+ *
+ * \return An arena object or NULL in case of failure
+ */
+mem_arena_t *mem_arena_new_flags(size_t size, unsigned int flags);
+
 /**
  * Create a new arean with embedd data.
  *
@@ -61,6 +316,30 @@ mem_arena_t *mem_arena_new(size_t size);
  */
 mem_arena_t *mem_arena_new_embed(size_t size, size_t embed_size, void **ptr);
 
+/**
+ * Create a child arena.
+ *
+ * The regions of the child, including the one holding the arena, are blocks
+ * allocated in parent, so creating and growing it costs no system call when
+ * the parent has room, and its memory stays with the parent's. Destroying the
+ * child frees its blocks in parent (see mem_free), a parent region is reused
+ * once all its blocks are freed. Children can have children, like scopes of
+ * work nested in each other.
+ *
+ * Resetting, rewinding before the child was created or destroying the parent
+ * releases the child and its own children at once: they must not be used,
+ * nor destroyed, anymore. The child has no flags and its regions are never
+ * unmapped nor remapped. With a concurrent parent, nothing is given back
+ * before the parent reset.
+ *
+ * \param[in] parent  Arena the regions come from
+ * \param[in] size    Like mem_arena_new, the size of the child regions. Better
+ *                    kept below the parent's to fit in its regions.
+ *
+ * \return An arena object or NULL in case of failure
+ */
+mem_arena_t *mem_arena_new_child(mem_arena_t *parent, size_t size);
+
 /**
  * Reset an arena.
  *
@@ -70,27 +349,282 @@ mem_arena_t *mem_arena_new_embed(size_t size, size_t embed_size, void **ptr);
  */
 void mem_arena_reset(mem_arena_t *arena);
 
+/**
+ * Set a geometric growth policy.
+ *
+ * By default every new region has the size given at creation (or the size of
+ * the allocation if bigger). With a factor above 1, each new region is factor
+ * times bigger than the previous one, up to max, so the region count grows
+ * logarithmically with the arena size.
+ *
+ * \param[in] arena   The arena
+ * \param[in] factor  Growth factor, 0 or 1 for no growth
+ * \param[in] max     Size new regions stop growing at
+ */
+void mem_arena_set_growth(mem_arena_t *arena, unsigned int factor,
+                          size_t max);
+
+/**
+ * Set a growth callback.
+ *
+ * fn is called for each new region with the minimum size it must hold and
+ * returns the size to use (a smaller one is raised to that minimum). It
+ * replaces the geometric policy, NULL goes back to it.
+ *
+ * \param[in] arena  The arena
+ * \param[in] fn     Growth callback
+ * \param[in] data   Passed to fn
+ */
+void mem_arena_set_growth_fn(mem_arena_t *arena, mem_arena_growth_fn fn,
+                             void *data);
+
+/**
+ * Mark the current position of an arena.
+ *
+ * O(1), it saves the tail region and its bump offset. Everything allocated
+ * after it can be released at once by mem_arena_rewind.
+ *
+ * \param[in] arena  The arena
+ *
+ * \return The mark, passed by value to mem_arena_rewind
+ */
+mem_arena_mark_t mem_arena_mark(mem_arena_t *arena);
+
+/**
+ * Rewind an arena to a mark.
+ *
+ * Every allocation made after the mark is released, regions used since then
+ * are emptied and kept for later allocation. Marks can be nested, rewinding
+ * to a mark invalidates the ones taken after it. Allocations made before the
+ * mark must not be freed between mark and rewind, and one of them grown in
+ * place after the mark is cut back to its previous end.
+ *
+ * \param[in] arena  The arena
+ * \param[in] mark   Mark returned by mem_arena_mark on that arena
+ */
+void mem_arena_rewind(mem_arena_t *arena, mem_arena_mark_t mark);
+
+/**
+ * Prefault ahead of the allocations.
+ *
+ * Once allocations come within ahead / 2 bytes of what was populated in the
+ * tail region, the next ahead bytes are populated at once (MADV_POPULATE_WRITE,
+ * or by touching each page), so there is one call per ahead / 2 bytes instead
+ * of a page fault per page. Ignored by concurrent arenas.
+ *
+ * \param[in] arena  The arena
+ * \param[in] ahead  Bytes populated ahead of the bump, 0 to stop
+ */
+void mem_arena_set_prefault(mem_arena_t *arena, size_t ahead);
+
+/**
+ * Prewarm an arena.
+ *
+ * Adds empty regions until the arena can hold size bytes, and populates the
+ * free space of every region, so the first allocations up to size neither
+ * map nor fault. Meant for startup, before the arena is shared by threads.
+ *
+ * \param[in] arena  The arena
+ * \param[in] size   Bytes the arena must hold
+ *
+ * \return 0 or -1 if a region couldn't be mapped
+ */
+int mem_arena_prewarm(mem_arena_t *arena, size_t size);
+
+/**
+ * Set the trim policy of an arena.
+ *
+ * Used by mem_arena_reset_trim. Memory is kept up to the larger of retain and
+ * a high water mark of the usage seen at each trimming reset. This mark loses
+ * a quarter at each of them, so after a spike the arena shrinks back over a
+ * few resets.
+ *
+ * \param[in] arena   The arena
+ * \param[in] retain  Bytes always kept, whatever the usage
+ * \param[in] policy  MEM_TRIM_* flags, 0 gives pages back with
+ *                    MADV_DONTNEED and keeps every region mapped
+ */
+void mem_arena_set_trim(mem_arena_t *arena, size_t retain,
+                        unsigned int policy);
+
+/**
+ * Reset an arena and give memory back.
+ *
+ * Like mem_arena_reset, then pages above the size kept by the trim policy are
+ * given back to the system with madvise, or their regions are unmapped (or
+ * put in the region cache) with MEM_TRIM_UNMAP. The region holding the arena
+ * is never unmapped.
+ *
+ * \param[in] arena  The arena to reset.
+ */
+void mem_arena_reset_trim(mem_arena_t *arena);
+
 /**
  * Destroy an arena.
  *
  * The whole arena is now invalid and the memory is released to the operating
- * system.
+ * system, or kept in the region cache if it is enabled. A child arena gives
+ * its memory back to its parent.
  *
  * \param[in] arena  The arena to destroy.
  */
 void mem_arena_destroy(mem_arena_t *arena);
+
+/**
+ * Get arena stats.
+ *
+ * Fill stats with a snapshot of the arena layout, walking its regions, and of
+ * its counters. Counters are plain increments (relaxed atomic ones for
+ * concurrent arenas) and can be compiled out by building the library with
+ * MEMARENA_NO_STATS. For concurrent arenas, peak is only as good as the
+ * snapshots taken, take it from the owner with no allocation running.
+ *
+ * \param[in]  arena  The arena
+ * \param[out] stats  Snapshot
+ */
+void mem_arena_stats(mem_arena_t *arena, mem_arena_stats_t *stats);
+
 /**
  * Dump stats
- * Dump some stats on stderr.
+ * Dump mem_arena_stats and the regions on stderr.
  */
 void mem_arena_dump(mem_arena_t *arena);
 
+/* *** Region cache *** */
+/**
+ * Set the region cache limit.
+ *
+ * Regions released by mem_arena_destroy are kept in a process wide cache, as
+ * long as it holds less than bytes, and new regions are taken from it before
+ * calling mmap. It is shared and locked, any thread can use it. Lowering the
+ * limit releases regions above it. Default is MEMARENA_REGION_CACHE_LIMIT, 0
+ * disables the cache.
+ *
+ * \param[in] bytes  Maximum bytes kept in the cache
+ */
+void mem_region_cache_set_limit(size_t bytes);
+
+/**
+ * Trim the region cache.
+ *
+ * Give cached regions back to the system until the cache holds at most bytes.
+ *
+ * \param[in] bytes  Bytes to keep, 0 empties the cache
+ */
+void mem_region_cache_trim(size_t bytes);
+
+/**
+ * Get region cache stats.
+ *
+ * Hits and misses count the region requests served by the cache or by mmap,
+ * misses are counted even when the cache is disabled, to help sizing it.
+ *
+ * \param[out] stats  Current limit, content and counters
+ */
+void mem_region_cache_stats(mem_region_cache_stats_t *stats);
+
+/* *** Scratch arena *** */
+/**
+ * Get a scratch arena for temporary allocation.
+ *
+ * Each thread has MEMARENA_SCRATCH_COUNT scratch arenas, created on first use
+ * and destroyed when the thread exits. Ending a scratch scope resets the arena
+ * instead of unmapping it, so temporary allocation costs no syscall once the
+ * arena has grown to its working size.
+ *
+ * A function allocating its result in an arena given by the caller, and
+ * needing scratch memory, passes that arena as conflict so it doesn't get the
+ * same one (which would be reset under the caller result).
+ *
+ * Scopes can be nested, each one is rewound when it ends (see
+ * mem_arena_rewind) and the outermost one resets the arena. Past
+ * MEMARENA_SCRATCH_DEPTH nested scopes, memory is given back when the scope at
+ * that depth ends.
+ *
+ * \param[in] conflict  Arena that must not be returned, can be NULL
+ *
+ * \return A scratch arena or NULL in case of failure
+ */
+mem_arena_t *mem_scratch_begin(mem_arena_t *conflict);
+
+/**
+ * End a scratch scope.
+ *
+ * Everything allocated in the scratch arena since the matching
+ * mem_scratch_begin is no longer valid.
+ *
+ * \param[in] scratch  Arena returned by mem_scratch_begin
+ */
+void mem_scratch_end(mem_arena_t *scratch);
+
 /* *** Allocation, free, ... *** */
 
 /** Malloc but with arena */
 void *mem_alloc(mem_arena_t *arena, size_t size);
-/** Realloc but with arena */
+/**
+ * Calloc but with arena
+ *
+ * Memory never handed out since its region was mapped is known to be zero
+ * and isn't cleared, only what was used before a mem_free, a rewind or a
+ * reset is. Regions from the region cache or from a parent arena are cleared
+ * as a whole, and so is everything in a concurrent arena.
+ *
+ * \return count * size zeroed bytes or NULL in case of failure or overflow
+ */
+void *mem_calloc(mem_arena_t *arena, size_t count, size_t size);
+/**
+ * Allocate aligned memory
+ *
+ * Like mem_alloc with the pointer aligned on align, a power of two (64 for a
+ * cache line, 32 or 64 for vector loads). The padding goes before the size
+ * header, so the block can be given to mem_free, mem_realloc and
+ * mem_memsize. mem_realloc may lose the alignment, use mem_realloc_aligned.
+ *
+ * \param[in] arena  The arena
+ * \param[in] size   Size to allocate
+ * \param[in] align  Alignment, a power of two
+ *
+ * \return Aligned pointer or NULL in case of failure or invalid alignment
+ */
+void *mem_alloc_aligned(mem_arena_t *arena, size_t size, size_t align);
+/**
+ * Allocate without header
+ *
+ * Raw bump allocation for small objects, no size header is stored so nothing
+ * more than size bytes is used (plus alignment padding). The pointer is
+ * aligned on the largest power of two dividing size, up to
+ * MEMARENA_ALIGNMENT, which is enough for any object of that size.
+ *
+ * As there's no header, the returned pointer must not be given to mem_free,
+ * mem_realloc or mem_memsize. The memory is released only by mem_arena_reset
+ * or mem_arena_destroy, and a region holding such block is never recycled by
+ * mem_free.
+ */
+void *mem_alloc_nohdr(mem_arena_t *arena, size_t size);
+/**
+ * Realloc but with arena
+ *
+ * The last allocation of a region grows in place when the region has room.
+ * When the block is alone in its region (as big allocations usually are), the
+ * region mapping itself is grown with mremap, so the data is never copied.
+ * Otherwise a new block is allocated and the data copied.
+ */
 void *mem_realloc(mem_arena_t *arena, void *ptr, size_t new_size);
+/**
+ * Realloc with zeroed growth
+ *
+ * Like mem_realloc, the bytes past the old size are zero, cleared only when
+ * they might not be (see mem_calloc).
+ */
+void *mem_realloc_zero(mem_arena_t *arena, void *ptr, size_t new_size);
+/**
+ * Realloc to aligned memory
+ *
+ * Like mem_realloc, the result is aligned on align, a power of two. A block
+ * already aligned grows in place the same way, others are moved.
+ */
+void *mem_realloc_aligned(mem_arena_t *arena, void *ptr, size_t new_size,
+                          size_t align);
 /**
  * Free
  * Try to reclaim a region if possible. Useful when working with dynamic
@@ -99,15 +633,430 @@ void *mem_realloc(mem_arena_t *arena, void *ptr, size_t new_size);
  * mem_alloc, the region is considered empty and will be recycled later on.
  * Also, as realloc, if free is done on a last allocation of a region, it
  * gives back the space to the region.
+ * The owning region is found through the allocation header, so ptr must have
+ * been returned by this arena.
  */
 void mem_free(mem_arena_t *arena, void *ptr);
 
+/* *** Inline allocation *** */
+
+#ifdef __cplusplus
+#define MEMARENA_ALIGNOF(T) alignof(T)
+#else
+#define MEMARENA_ALIGNOF(T) _Alignof(T)
+#endif /* __cplusplus */
+
+/** Allocate a T, uninitialized, see mem_alloc_inline */
+#define MEM_NEW(arena, T)                                                      \
+  ((T *)_mem_new((arena), sizeof(T), MEMARENA_ALIGNOF(T)))
+/** Allocate an array of n T, uninitialized, NULL if n * sizeof(T) overflows */
+#define MEM_NEW_ARRAY(arena, T, n)                                             \
+  ((T *)_mem_new_array((arena), (n), sizeof(T), MEMARENA_ALIGNOF(T)))
+
+#ifndef MEMARENA_NO_STATS
+/* same accounting as mem_alloc */
+static inline void _mem_alloc_stats(mem_arena_t *arena, size_t size,
+                                    size_t from, size_t to) {
+  int size_class = (int)(sizeof(unsigned long long) * 8 - 1) -
+                   __builtin_clzll((unsigned long long)size);
+  if (size_class >= MEMARENA_STATS_CLASSES) {
+    size_class = MEMARENA_STATS_CLASSES - 1;
+  }
+  arena->stats.allocs++;
+  arena->stats.requested += size;
+  arena->stats.overhead += to - from - size;
+  arena->stats.histogram[size_class]++;
+  arena->stats.used += to - from;
+  if (arena->stats.used > arena->stats.peak) {
+    arena->stats.peak = arena->stats.used;
+  }
+}
+#endif /* MEMARENA_NO_STATS */
+
+/**
+ * Inlined mem_alloc
+ *
+ * Same as mem_alloc, with the common case inlined: the tail region has room,
+ * bump and return. Anything else (new region, concurrent, free list or
+ * prefaulting arena, invalid arguments) goes through mem_alloc. The library
+ * and its user must agree on MEMARENA_NO_STATS and MEMARENA_ALIGNMENT.
+ */
+static inline void *mem_alloc_inline(mem_arena_t *arena, size_t size) {
+  /* size - 1 wraps for 0, so it also checks size >= 1 */
+  if (__builtin_expect(
+          arena != NULL && size - 1 < SIZE_MAX / 2 &&
+              !(arena->flags & (MEM_ARENA_CONCURRENT | MEM_ARENA_FREELIST)) &&
+              arena->prefault_ahead == 0,
+          1)) {
+    mem_arena_region_t *region = arena->tail;
+    size_t start = MEMARENA_ALIGNED_SIZE(region->used);
+    size_t need = MEMARENA_ALIGNED_SIZE(size) + MEMARENA_HEADER_SIZE;
+    if (__builtin_expect(region->capacity - start >= need, 1)) {
+      mem_arena_block_t *block = (mem_arena_block_t *)(region->data + start);
+      unsigned char *ptr = (unsigned char *)block + MEMARENA_HEADER_SIZE;
+      block->size = size;
+      block->region = region;
+#ifndef MEMARENA_NO_STATS
+      _mem_alloc_stats(arena, size, region->used, start + need);
+#endif /* MEMARENA_NO_STATS */
+      region->used = start + need;
+      region->last_alloc = ptr;
+      region->alloc_cnt++;
+      return ptr;
+    }
+  }
+  return mem_alloc(arena, size);
+}
+
+static inline void *_mem_new(mem_arena_t *arena, size_t size, size_t align) {
+  if (align > MEMARENA_ALIGNMENT) {
+    return mem_alloc_aligned(arena, size, align);
+  }
+  return mem_alloc_inline(arena, size);
+}
+
+static inline void *_mem_new_array(mem_arena_t *arena, size_t n, size_t size,
+                                   size_t align) {
+  if (n > SIZE_MAX / 2 / size) {
+    return NULL;
+  }
+  return _mem_new(arena, n * size, align);
+}
+
+/* *** Vector *** */
+/**
+ * Init a vector.
+ *
+ * The mem_vec_t can be anywhere, typically in the embed area of the arena
+ * (see mem_arena_new_embed) so it survives resets. Its buffer is allocated in
+ * the arena: while it is the last allocation of its region it grows in place,
+ * otherwise its capacity doubles. A reset of the arena empties the vector,
+ * it's checked in O(1) by the next call. Rewinding the arena before the
+ * buffer was allocated, or freeing it, is not allowed.
+ *
+ * \param[out] vec        The vector
+ * \param[in]  arena      Arena the elements are allocated in
+ * \param[in]  elem_size  Size of an element
+ */
+void mem_vec_init(mem_vec_t *vec, mem_arena_t *arena, size_t elem_size);
+
+/**
+ * Allocate and init a vector in the arena.
+ *
+ * The vector itself goes away with the next reset.
+ *
+ * \return The vector or NULL in case of failure
+ */
+mem_vec_t *mem_vec_new(mem_arena_t *arena, size_t elem_size);
+
+/**
+ * Reserve room.
+ *
+ * \param[in] vec       The vector
+ * \param[in] capacity  Elements the vector can hold without growing
+ *
+ * \return 0 or -1 in case of failure, the vector is then unchanged
+ */
+int mem_vec_reserve(mem_vec_t *vec, size_t capacity);
+
+/**
+ * Append an element.
+ *
+ * \param[in] vec   The vector
+ * \param[in] elem  Copied in the new element, if not NULL
+ *
+ * \return The new element or NULL in case of failure
+ */
+void *mem_vec_push(mem_vec_t *vec, const void *elem);
+
+/**
+ * Append count elements.
+ *
+ * \param[in] vec    The vector
+ * \param[in] elems  Copied in the new elements, if not NULL
+ * \param[in] count  Number of elements
+ *
+ * \return The first new element or NULL in case of failure
+ */
+void *mem_vec_append(mem_vec_t *vec, const void *elems, size_t count);
+
+/**
+ * Remove the last element.
+ *
+ * \param[in]  vec   The vector
+ * \param[out] elem  Receives the element, if not NULL
+ *
+ * \return 0 or -1 if the vector is empty
+ */
+int mem_vec_pop(mem_vec_t *vec, void *elem);
+
+/**
+ * Shrink the capacity to the length.
+ *
+ * When the buffer is the last allocation of its region, the space is given
+ * back to the region.
+ */
+void mem_vec_shrink(mem_vec_t *vec);
+
+/** Remove every element, the capacity is kept */
+void mem_vec_clear(mem_vec_t *vec);
+
+/* forget a buffer allocated before the last arena reset */
+static inline void _mem_vec_sync(mem_vec_t *vec) {
+  if (vec->generation != vec->arena->generation) {
+    vec->data = NULL;
+    vec->length = 0;
+    vec->capacity = 0;
+    vec->generation = vec->arena->generation;
+  }
+}
+
+/** Number of elements */
+static inline size_t mem_vec_length(mem_vec_t *vec) {
+  _mem_vec_sync(vec);
+  return vec->length;
+}
+
+/** Elements, NULL when the vector has no buffer */
+static inline void *mem_vec_data(mem_vec_t *vec) {
+  _mem_vec_sync(vec);
+  return vec->data;
+}
+
+/** Element i, NULL if out of bounds */
+static inline void *mem_vec_at(mem_vec_t *vec, size_t i) {
+  _mem_vec_sync(vec);
+  if (i >= vec->length) {
+    return NULL;
+  }
+  return (unsigned char *)vec->data + i * vec->elem_size;
+}
+
+/* *** String builder *** */
+/**
+ * Init a string builder.
+ *
+ * The string is built in one buffer of the arena, grown like a mem_vec_t: in
+ * place while it's the last allocation of its region, doubled otherwise. So
+ * appending and formatting cost no intermediate allocation. Like mem_vec_t,
+ * a reset of the arena empties it.
+ *
+ * \param[out] str    The builder
+ * \param[in]  arena  Arena the string is allocated in
+ */
+void mem_str_init(mem_str_t *str, mem_arena_t *arena);
+
+/**
+ * Append bytes.
+ *
+ * \return 0 or -1 in case of failure, the string is then unchanged
+ */
+int mem_str_append(mem_str_t *str, const void *bytes, size_t length);
+
+/** Append a NUL terminated string, see mem_str_append */
+int mem_str_appends(mem_str_t *str, const char *string);
+
+/** Append a character, see mem_str_append */
+int mem_str_appendc(mem_str_t *str, char c);
+
+/**
+ * Append formatted output.
+ *
+ * Formatted with vsnprintf right at the end of the string, the buffer grows
+ * first if it's too small.
+ *
+ * \return 0 or -1 in case of failure, the string is then unchanged
+ */
+int mem_str_printf(mem_str_t *str, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Same as mem_str_printf with a va_list */
+int mem_str_vprintf(mem_str_t *str, const char *format, va_list args);
+
+/**
+ * Finish the string.
+ *
+ * The buffer is shrunk to the string, and the builder starts a new empty
+ * string. The result lives in the arena like any allocation.
+ *
+ * \return The NUL terminated string or NULL if nothing was ever appended or
+ *         in case of failure
+ */
+char *mem_str_finish(mem_str_t *str);
+
+/** Length of the string being built */
+static inline size_t mem_str_length(mem_str_t *str) {
+  return mem_vec_length(&str->vec);
+}
+
+/** String being built, NUL terminated, valid until the next append */
+static inline const char *mem_str_cstr(mem_str_t *str) {
+  const char *data = (const char *)mem_vec_data(&str->vec);
+  return data ? data : "";
+}
+
+/* *** String interning *** */
+/**
+ * Init an interning table.
+ *
+ * Interned strings are unique: interning equal strings gives the same
+ * pointer, so they compare with ==. The buckets and the string bytes are
+ * allocated in arena. A reset of that arena empties the table (in O(1), on
+ * its next use) and it is rebuilt as strings are interned again, see
+ * mem_intern_init_flags for a table surviving resets.
+ *
+ * Strings are stored without header (see mem_alloc_nohdr), they must not be
+ * given to mem_free, mem_realloc or mem_memsize.
+ *
+ * \param[out] table  The table
+ * \param[in]  arena  Arena the table and strings are allocated in
+ */
+void mem_intern_init(mem_intern_t *table, mem_arena_t *arena);
+
+/**
+ * Init an interning table with flags.
+ *
+ * Without flags, same as mem_intern_init. With MEM_INTERN_PERSISTENT the
+ * buckets and strings go to an arena the table creates for itself, so
+ * interned strings stay valid whatever arena is reset. That arena is
+ * released by mem_intern_destroy.
+ *
+ * \param[out] table  The table
+ * \param[in]  arena  Arena the table and strings are allocated in, not used
+ *                    (may be NULL) with MEM_INTERN_PERSISTENT
+ * \param[in]  flags  0 or MEM_INTERN_PERSISTENT
+ *
+ * \return 0 or -1 if the arena of the table couldn't be created
+ */
+int mem_intern_init_flags(mem_intern_t *table, mem_arena_t *arena,
+                          unsigned int flags);
+
+/**
+ * Destroy an interning table.
+ *
+ * Releases the arena of a MEM_INTERN_PERSISTENT table, its strings with it.
+ * Nothing to do for others, their arena holds everything.
+ *
+ * \param[in] table  The table
+ */
+void mem_intern_destroy(mem_intern_t *table);
+
+/**
+ * Intern bytes.
+ *
+ * \param[in] table   The table
+ * \param[in] bytes   String, not necessarily NUL terminated
+ * \param[in] length  Length of the string, below 4 GiB
+ *
+ * \return The interned, NUL terminated, string or NULL in case of failure
+ */
+const char *mem_intern_n(mem_intern_t *table, const char *bytes,
+                         size_t length);
+
+/** Intern a NUL terminated string, see mem_intern_n */
+const char *mem_intern(mem_intern_t *table, const char *string);
+
+/**
+ * Look a string up.
+ *
+ * \return The interned string or NULL if it was not interned
+ */
+const char *mem_intern_lookup(mem_intern_t *table, const char *bytes,
+                              size_t length);
+
+/** Number of interned strings */
+size_t mem_intern_count(mem_intern_t *table);
+
+/* *** Object pool *** */
+/**
+ * Init an object pool.
+ *
+ * Objects of one size are cut, without header, from slabs of
+ * MEMARENA_POOL_SLAB bytes allocated in arena. Freed objects are kept on a
+ * free list and handed out again first, both in O(1). A reset of the arena
+ * releases every object at once, the pool starts over on its next use.
+ * Rewinding the arena before a slab was allocated is not allowed.
+ *
+ * Without flags the pool is used by one thread at a time. With
+ * MEM_POOL_THREAD_CACHE threads may share it: each thread takes and gives
+ * back objects by batches, under the pool lock, to a cache of its own. The
+ * arena must be concurrent (see MEM_ARENA_CONCURRENT) if it's used by other
+ * threads at the same time. A thread caches up to 8 such pools, the least
+ * recently used one is set aside to make room for another and its objects
+ * are taken back by the pool before it cuts a new slab (up to 64 evicted
+ * caches are kept, process wide). Objects cached by a thread that exits stay
+ * out of the pool until the next reset.
+ *
+ * \param[out] pool   The pool
+ * \param[in]  arena  Arena the slabs are allocated in
+ * \param[in]  size   Size of an object, at least a pointer is used
+ * \param[in]  align  Alignment of the objects, a power of two or 0 for
+ *                    MEMARENA_ALIGNMENT
+ * \param[in]  flags  0 or MEM_POOL_THREAD_CACHE
+ */
+void mem_pool_init(mem_pool_t *pool, mem_arena_t *arena, size_t size,
+                   size_t align, unsigned int flags);
+
+/**
+ * Allocate and init a pool in the arena.
+ *
+ * The pool itself goes away with the next reset.
+ *
+ * \return The pool or NULL in case of failure
+ */
+mem_pool_t *mem_pool_new(mem_arena_t *arena, size_t size, size_t align,
+                         unsigned int flags);
+
+/**
+ * Allocate an object.
+ *
+ * \return The object, not zeroed, or NULL in case of failure
+ */
+void *mem_pool_alloc(mem_pool_t *pool);
+
+/**
+ * Free an object.
+ *
+ * \param[in] pool  The pool
+ * \param[in] ptr   Object allocated by this pool, or NULL
+ */
+void mem_pool_free(mem_pool_t *pool, void *ptr);
+
 /* *** String function *** */
 
-/** Strndup but with arena */
+/**
+ * Strndup but with arena
+ *
+ * No byte past length is read, so string doesn't need to be NUL terminated.
+ * A short string is scanned and copied in a single memccpy pass.
+ */
 char *mem_strndup(mem_arena_t *arena, const char *string, size_t length);
 /** Strdup but with arena */
 char *mem_strdup(mem_arena_t *arena, const char *string);
+/**
+ * Duplicate many strings in one block
+ *
+ * The strings are copied one after the other, NUL terminated, in a single
+ * allocation. out[i] gets the copy of strings[i].
+ *
+ * \param[in]  arena    The arena
+ * \param[in]  strings  NUL terminated strings
+ * \param[in]  count    Number of strings
+ * \param[out] out      Array of count pointers, receives the copies
+ *
+ * \return The block, which is out[0], to give to mem_free for all of them,
+ *         or NULL in case of failure
+ */
+char *mem_strdup_batch(mem_arena_t *arena, const char *const *strings,
+                       size_t count, char **out);
+/**
+ * Duplicate many bounded strings in one block
+ *
+ * Same as mem_strdup_batch, with strings[i] bounded like mem_strndup by
+ * lengths[i]. Useful to extract fields of a buffer.
+ */
+char *mem_strndup_batch(mem_arena_t *arena, const char *const *strings,
+                        const size_t *lengths, size_t count, char **out);
 
 /* *** Utility function *** */
 
@@ -122,4 +1071,8 @@ void *mem_memdup(mem_arena_t *arena, const void *ptr, size_t length);
  * \return The size of the allocated memory
  */
 size_t mem_memsize(mem_arena_t *arena, const void *ptr);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
 #endif /* MEMARENA_H__ */
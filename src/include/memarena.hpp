@@ -0,0 +1,168 @@
+#ifndef MEMARENA_HPP__
+#define MEMARENA_HPP__
+
+#include "memarena.h"
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* C++ adapters over the C API: RAII owners for arenas and marks, a
+ * std::pmr::memory_resource and a stateful allocator for STL containers. */
+
+namespace memarena {
+
+/* *** RAII owners *** */
+
+/**
+ * Arena owner
+ *
+ * Creates the arena (throws std::bad_alloc on failure) and destroys it with
+ * the object. Movable, not copyable.
+ */
+class arena {
+public:
+  explicit arena(std::size_t size = 0, unsigned int flags = 0)
+      : arena_(mem_arena_new_flags(size, flags)) {
+    if (arena_ == nullptr) {
+      throw std::bad_alloc();
+    }
+  }
+  ~arena() { mem_arena_destroy(arena_); }
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+  arena(arena &&other) noexcept
+      : arena_(std::exchange(other.arena_, nullptr)) {}
+  arena &operator=(arena &&other) noexcept {
+    if (this != &other) {
+      mem_arena_destroy(arena_);
+      arena_ = std::exchange(other.arena_, nullptr);
+    }
+    return *this;
+  }
+
+  mem_arena_t *get() const noexcept { return arena_; }
+  operator mem_arena_t *() const noexcept { return arena_; }
+
+  void reset() noexcept { mem_arena_reset(arena_); }
+
+private:
+  mem_arena_t *arena_;
+};
+
+/**
+ * Savepoint
+ *
+ * Marks the arena when created and rewinds it when destroyed, everything
+ * allocated in the scope is released at once (see mem_arena_rewind).
+ */
+class savepoint {
+public:
+  explicit savepoint(mem_arena_t *arena) noexcept
+      : arena_(arena), mark_(mem_arena_mark(arena)) {}
+  ~savepoint() { mem_arena_rewind(arena_, mark_); }
+
+  savepoint(const savepoint &) = delete;
+  savepoint &operator=(const savepoint &) = delete;
+
+  /* release what was allocated since the mark, the mark stays */
+  void rewind() noexcept { mem_arena_rewind(arena_, mark_); }
+
+private:
+  mem_arena_t *arena_;
+  mem_arena_mark_t mark_;
+};
+
+/* *** Allocation *** */
+
+/* allocate bytes aligned on align, throws std::bad_alloc */
+inline void *allocate(mem_arena_t *arena, std::size_t bytes,
+                      std::size_t align) {
+  /* containers may ask for 0 bytes, the arena doesn't allow it */
+  if (bytes == 0) {
+    bytes = 1;
+  }
+  void *ptr = align > MEMARENA_ALIGNMENT
+                  ? mem_alloc_aligned(arena, bytes, align)
+                  : mem_alloc_inline(arena, bytes);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+/**
+ * Memory resource
+ *
+ * std::pmr::memory_resource over an arena it doesn't own. Deallocation is
+ * mem_free: the space of the last allocation of a region is given back and a
+ * region is reused once all its blocks are deallocated, anything else is
+ * released by reset or destroy.
+ */
+class memory_resource : public std::pmr::memory_resource {
+public:
+  explicit memory_resource(mem_arena_t *arena) noexcept : arena_(arena) {}
+
+  mem_arena_t *get() const noexcept { return arena_; }
+
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t align) override {
+    return memarena::allocate(arena_, bytes, align);
+  }
+  void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+    mem_free(arena_, ptr);
+  }
+  bool do_is_equal(
+      const std::pmr::memory_resource &other) const noexcept override {
+    auto *resource = dynamic_cast<const memory_resource *>(&other);
+    return resource != nullptr && resource->arena_ == arena_;
+  }
+
+private:
+  mem_arena_t *arena_;
+};
+
+/**
+ * STL allocator
+ *
+ * Stateful allocator keeping the arena, without the virtual calls of a
+ * memory_resource. Containers using it must not outlive the arena.
+ */
+template <class T> class allocator {
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  explicit allocator(mem_arena_t *arena) noexcept : arena_(arena) {}
+  template <class U>
+  allocator(const allocator<U> &other) noexcept : arena_(other.get()) {}
+
+  T *allocate(std::size_t n) {
+    if (n > SIZE_MAX / 2 / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T *>(
+        memarena::allocate(arena_, n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *ptr, std::size_t) noexcept { mem_free(arena_, ptr); }
+
+  mem_arena_t *get() const noexcept { return arena_; }
+
+  template <class U> bool operator==(const allocator<U> &other) const noexcept {
+    return arena_ == other.get();
+  }
+  template <class U> bool operator!=(const allocator<U> &other) const noexcept {
+    return arena_ != other.get();
+  }
+
+private:
+  mem_arena_t *arena_;
+};
+
+} /* namespace memarena */
+
+#endif /* MEMARENA_HPP__ */
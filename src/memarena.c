@@ -1,7 +1,13 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* mremap */
+#endif              /* _GNU_SOURCE */
 #include "include/memarena.h"
 #include <assert.h>
 #include <bits/time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdalign.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,59 +17,450 @@
 #include <time.h>
 #include <unistd.h>
 
-#define ALIGNED_SIZE(x)                                                        \
-  ((((x) + (MEMARENA_ALIGNMENT - 1)) / MEMARENA_ALIGNMENT) * MEMARENA_ALIGNMENT)
-#define REGION_FREE_SPACE(r)                                                   \
-  ((r)->capacity - (r)->used - ALIGNED_SIZE(sizeof(size_t)))
-#define GET_SIZE_T_PTR_FROM_PTR(ptr)                                           \
-  (size_t *)((uint8_t *)(ptr) - ALIGNED_SIZE(sizeof(size_t)));
+#define ALIGNED_SIZE(x) MEMARENA_ALIGNED_SIZE(x)
+#define HEADER_SIZE MEMARENA_HEADER_SIZE
+/* headerless allocations may leave used unaligned */
+#define REGION_FREE_SPACE(r) ((r)->capacity - ALIGNED_SIZE((r)->used))
+/* concurrent bump can push used past capacity, see _alloc_concurrent */
+#define REGION_USED(r) ((r)->used > (r)->capacity ? (r)->capacity : (r)->used)
+#define GET_BLOCK_FROM_PTR(ptr)                                                \
+  ((mem_arena_block_t *)((uint8_t *)(ptr) - HEADER_SIZE))
+/* the region structure is at the start of the mapping and data is moved
+ * forward for each embedded structure, so this gives back the mmap'd size */
+#define REGION_MAPPED_SIZE(r)                                                  \
+  ((size_t)((r)->data - (unsigned char *)(r)) + (r)->capacity)
 
 /* an arena with 1 allocation will use that amount of data, at least :
  * -> the embedd arena structure
  * -> the embedd region structure
- * -> the size_t where the 1 allocation will store its size
+ * -> the block header where the 1 allocation will store its size
  */
 #define MIN_OVERHEAD_R0                                                        \
-  (sizeof(mem_arena_t) + sizeof(mem_arena_region_t) + sizeof(size_t))
-#define MIN_OVERHEAD_RX (sizeof(mem_arena_region_t) + sizeof(size_t))
-
-static mem_arena_region_t *_new_region(size_t size, int pagesize) {
-  size = ((size + pagesize - 1) / pagesize) * pagesize;
-  mem_arena_region_t *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  if (region != MAP_FAILED) {
-    size_t head_size = ALIGNED_SIZE(sizeof(*region));
-    region->alloc_cnt = 0;
-    region->data = (unsigned char *)region + head_size;
-    region->capacity = size - head_size;
-    region->used = 0;
-    region->next = NULL;
-  } else {
+  (ALIGNED_SIZE(sizeof(mem_arena_t)) +                                         \
+   ALIGNED_SIZE(sizeof(mem_arena_region_t)) + HEADER_SIZE)
+#define MIN_OVERHEAD_RX                                                        \
+  (ALIGNED_SIZE(sizeof(mem_arena_region_t)) + HEADER_SIZE)
+#define ROUND_UP(x, n) ((((x) + (n) - 1) / (n)) * (n))
+#define ROUND_UP_POW2(x, n) (((x) + (n) - 1) & ~((n) - 1))
+
+/* region flags, how the region is backed */
+#define REGION_HUGETLB 0x1 /* MAP_HUGETLB, from reserved huge pages */
+#define REGION_THP 0x2     /* huge page aligned with MADV_HUGEPAGE */
+#define REGION_HUGE (REGION_HUGETLB | REGION_THP)
+#define REGION_CACHED 0x4 /* taken from the region cache, not mapped */
+#define REGION_BORROWED 0x8 /* block of the parent arena, not mapped */
+/* holds the mem_arena_t, it's head only until mem_free recycles it */
+#define REGION_ARENA 0x10
+
+#ifdef MAP_HUGETLB
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif /* MAP_HUGE_2MB */
+#endif /* MAP_HUGETLB */
+
+/* worst case padding to align a pointer which has the default alignment */
+static inline size_t _align_padding(size_t align) {
+  return align > MEMARENA_ALIGNMENT ? align - MEMARENA_ALIGNMENT : 0;
+}
+
+static int _bin_index(size_t size) {
+  return (int)(sizeof(unsigned long long) * 8 - 1) -
+         __builtin_clzll((unsigned long long)size);
+}
+
+/* *** Stats counters *** */
+
+/* Counters are plain adds, relaxed atomic ones for concurrent arenas. Live
+ * used bytes (for peak) are only tracked by non concurrent arenas, the
+ * others get it from mem_arena_stats walks.
+ */
+#ifndef MEMARENA_NO_STATS
+#define STAT_ADD(arena, field, n)                                              \
+  do {                                                                         \
+    if ((arena)->flags & MEM_ARENA_CONCURRENT) {                               \
+      __atomic_fetch_add(&(arena)->stats.field, (n), __ATOMIC_RELAXED);        \
+    } else {                                                                   \
+      (arena)->stats.field += (n);                                             \
+    }                                                                          \
+  } while (0)
+#define STAT_ALLOC(arena, size, extra)                                         \
+  do {                                                                         \
+    int _class = _bin_index(size);                                             \
+    if (_class >= MEMARENA_STATS_CLASSES) {                                    \
+      _class = MEMARENA_STATS_CLASSES - 1;                                     \
+    }                                                                          \
+    STAT_ADD(arena, allocs, 1);                                                \
+    STAT_ADD(arena, requested, (size));                                        \
+    STAT_ADD(arena, overhead, (extra));                                        \
+    STAT_ADD(arena, histogram[_class], 1);                                     \
+  } while (0)
+/* a region used went from from to to, wraps around when it decreases */
+#define STAT_USED(arena, from, to)                                             \
+  do {                                                                         \
+    (arena)->stats.used += (size_t)(to) - (size_t)(from);                      \
+    if ((arena)->stats.used > (arena)->stats.peak) {                           \
+      (arena)->stats.peak = (arena)->stats.used;                               \
+    }                                                                          \
+  } while (0)
+#define STAT_REGION(arena, region)                                             \
+  do {                                                                         \
+    if (!((region)->flags & (REGION_CACHED | REGION_BORROWED))) {              \
+      STAT_ADD(arena, mmaps, 1);                                               \
+    }                                                                          \
+  } while (0)
+#else
+#define STAT_ADD(arena, field, n) ((void)0)
+#define STAT_ALLOC(arena, size, extra) ((void)0)
+#define STAT_USED(arena, from, to) ((void)0)
+#define STAT_REGION(arena, region) ((void)0)
+#endif /* MEMARENA_NO_STATS */
+
+/* *** Region cache *** */
+
+/* regions released by any arena, bucketed like the arena bins by their mapped
+ * size, each bucket linked through next */
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_arena_region_t *_cache[MEMARENA_BINS];
+static size_t _cache_limit = MEMARENA_REGION_CACHE_LIMIT;
+static size_t _cache_bytes = 0;
+static size_t _cache_regions = 0;
+static size_t _cache_hits = 0;
+static size_t _cache_misses = 0;
+
+/* Get a cached region of at least size bytes. Only a few regions of the
+ * bucket size falls in are looked at, then the head of the next bucket which
+ * always fits without wasting more than 4 times the size. When huge is set,
+ * only huge page backed regions are taken.
+ */
+static mem_arena_region_t *_cache_take(size_t size, int huge) {
+  if (__atomic_load_n(&_cache_bytes, __ATOMIC_RELAXED) == 0) {
+    __atomic_fetch_add(&_cache_misses, 1, __ATOMIC_RELAXED);
     return NULL;
   }
+  int i = _bin_index(size);
+  mem_arena_region_t *region = NULL;
+  pthread_mutex_lock(&_cache_lock);
+  mem_arena_region_t **link = &_cache[i];
+  for (int tries = 0; *link != NULL && tries < 8; tries++) {
+    if (REGION_MAPPED_SIZE(*link) >= size &&
+        (!huge || ((*link)->flags & REGION_HUGE))) {
+      region = *link;
+      break;
+    }
+    link = (mem_arena_region_t **)&(*link)->next;
+  }
+  if (region == NULL && (size_t)i + 1 < MEMARENA_BINS && _cache[i + 1] &&
+      (!huge || (_cache[i + 1]->flags & REGION_HUGE))) {
+    link = &_cache[i + 1];
+    region = *link;
+  }
+  if (region) {
+    *link = (mem_arena_region_t *)region->next;
+    __atomic_fetch_sub(&_cache_bytes, REGION_MAPPED_SIZE(region),
+                       __ATOMIC_RELAXED);
+    _cache_regions--;
+    _cache_hits++;
+  } else {
+    __atomic_fetch_add(&_cache_misses, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&_cache_lock);
+  return region;
+}
+
+/* remove regions from the cache until it holds at most max bytes, caller
+ * holds the lock and will munmap the returned list */
+static mem_arena_region_t *_cache_shrink(size_t max) {
+  mem_arena_region_t *list = NULL;
+  /* biggest first */
+  for (int i = MEMARENA_BINS - 1; i >= 0 && _cache_bytes > max; i--) {
+    while (_cache[i] && _cache_bytes > max) {
+      mem_arena_region_t *region = _cache[i];
+      _cache[i] = (mem_arena_region_t *)region->next;
+      __atomic_fetch_sub(&_cache_bytes, REGION_MAPPED_SIZE(region),
+                         __ATOMIC_RELAXED);
+      _cache_regions--;
+      region->next = list;
+      list = region;
+    }
+  }
+  return list;
+}
+
+static void _unmap_list(mem_arena_region_t *list) {
+  while (list) {
+    mem_arena_region_t *next = (mem_arena_region_t *)list->next;
+    munmap(list, REGION_MAPPED_SIZE(list));
+    list = next;
+  }
+}
+
+/* Give a region back, to the cache if there's room else to the system */
+static void _release_region(mem_arena_region_t *region) {
+  size_t size = REGION_MAPPED_SIZE(region);
+  if (size <= __atomic_load_n(&_cache_limit, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&_cache_lock);
+    if (_cache_bytes + size <= _cache_limit) {
+      /* drop any embedded structure, data starts after region header */
+      size_t head_size = ALIGNED_SIZE(sizeof(*region));
+      region->data = (unsigned char *)region + head_size;
+      region->capacity = size - head_size;
+      int i = _bin_index(size);
+      region->next = _cache[i];
+      _cache[i] = region;
+      __atomic_fetch_add(&_cache_bytes, size, __ATOMIC_RELAXED);
+      _cache_regions++;
+      region = NULL;
+    }
+    pthread_mutex_unlock(&_cache_lock);
+  }
+  if (region) {
+    munmap(region, size);
+  }
+}
+
+void mem_region_cache_set_limit(size_t bytes) {
+  pthread_mutex_lock(&_cache_lock);
+  __atomic_store_n(&_cache_limit, bytes, __ATOMIC_RELAXED);
+  mem_arena_region_t *list = _cache_shrink(bytes);
+  pthread_mutex_unlock(&_cache_lock);
+  _unmap_list(list);
+}
+
+void mem_region_cache_trim(size_t bytes) {
+  pthread_mutex_lock(&_cache_lock);
+  mem_arena_region_t *list = _cache_shrink(bytes);
+  pthread_mutex_unlock(&_cache_lock);
+  _unmap_list(list);
+}
+
+void mem_region_cache_stats(mem_region_cache_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&_cache_lock);
+  stats->limit = _cache_limit;
+  stats->bytes = _cache_bytes;
+  stats->regions = _cache_regions;
+  stats->hits = _cache_hits;
+  stats->misses = __atomic_load_n(&_cache_misses, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&_cache_lock);
+}
+
+/* region identity, kept when mremap moves a region, renewed on reuse */
+static size_t _region_ids = 0;
+
+/* Map size bytes backed by huge pages. Reserved huge pages are tried first,
+ * then a huge page aligned mapping advised for transparent huge pages.
+ */
+static void *_map_hugepage(size_t size, unsigned int *region_flags) {
+  void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+  if (ptr != MAP_FAILED) {
+    *region_flags = REGION_HUGETLB;
+    return ptr;
+  }
+#endif /* MAP_HUGETLB */
+  uint8_t *raw = mmap(NULL, size + MEMARENA_HUGEPAGE_SIZE,
+                      PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1,
+                      0);
+  if (raw == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  uint8_t *aligned =
+      (uint8_t *)ROUND_UP((uintptr_t)raw, MEMARENA_HUGEPAGE_SIZE);
+  if (aligned > raw) {
+    munmap(raw, aligned - raw);
+  }
+  if (raw + MEMARENA_HUGEPAGE_SIZE > aligned) {
+    munmap(aligned + size, raw + MEMARENA_HUGEPAGE_SIZE - aligned);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+  *region_flags = REGION_THP;
+  return aligned;
+}
+
+static void _init_region(mem_arena_region_t *region, size_t size,
+                         unsigned int flags) {
+  size_t head_size = ALIGNED_SIZE(sizeof(*region));
+  region->alloc_cnt = 0;
+  region->data = (unsigned char *)region + head_size;
+  region->capacity = size - head_size;
+  region->used = 0;
+  region->last_alloc = NULL;
+  region->next = NULL;
+  region->prev = NULL;
+  region->bin = -1;
+  region->bin_next = NULL;
+  region->bin_prev = NULL;
+  region->flags = flags;
+  region->id = __atomic_add_fetch(&_region_ids, 1, __ATOMIC_RELAXED);
+  region->prefaulted = 0;
+  /* cached or borrowed memory was used before */
+  region->dirty =
+      flags & (REGION_CACHED | REGION_BORROWED) ? region->capacity : 0;
+}
+
+/* used is about to go down, keep its high water mark for mem_calloc */
+static inline void _region_dirty(mem_arena_region_t *region) {
+  size_t used = REGION_USED(region);
+  if (used > region->dirty) {
+    region->dirty = used;
+  }
+}
+
+/* populate the pages of [start, end) so they don't fault on first write */
+static void _populate(uint8_t *start, uint8_t *end) {
+  uintptr_t pagesize = (uintptr_t)getpagesize();
+  if (start >= end) {
+    return;
+  }
+#ifdef MADV_POPULATE_WRITE
+  /* doesn't change the content, the whole first page can be given */
+  uint8_t *first = (uint8_t *)((uintptr_t)start & ~(pagesize - 1));
+  if (madvise(first, (size_t)(end - first), MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif /* MADV_POPULATE_WRITE */
+  /* older kernels, write each page starting within the range */
+  for (uint8_t *page = (uint8_t *)ROUND_UP_POW2((uintptr_t)start, pagesize);
+       page < end; page += pagesize) {
+    *(volatile uint8_t *)page = *(volatile uint8_t *)page;
+  }
+}
+
+static mem_arena_region_t *_new_region(size_t size, size_t pagesize,
+                                       unsigned int flags) {
+  size = ROUND_UP(size, pagesize);
+  unsigned int region_flags = 0;
+  mem_arena_region_t *region =
+      _cache_take(size, (flags & MEM_ARENA_HUGEPAGE) != 0);
+  if (region) {
+    size = REGION_MAPPED_SIZE(region);
+    /* only how it is backed, not what it was used for */
+    region_flags = (region->flags & REGION_HUGE) | REGION_CACHED;
+  } else {
+    int map_flags = MAP_ANONYMOUS | MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (flags & MEM_ARENA_POPULATE) {
+      map_flags |= MAP_POPULATE;
+    }
+#endif /* MAP_POPULATE */
+    if (flags & MEM_ARENA_HUGEPAGE) {
+      region = _map_hugepage(size, &region_flags);
+    } else {
+      region = mmap(NULL, size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+    }
+    if (region == MAP_FAILED) {
+      return NULL;
+    }
+  }
+  _init_region(region, size, region_flags);
+  if (flags & MEM_ARENA_POPULATE) {
+    /* cached and huge page regions weren't mapped with MAP_POPULATE, and a
+     * cached one may have been trimmed */
+    if (region_flags & (REGION_CACHED | REGION_HUGE)) {
+      _populate(region->data, region->data + region->capacity);
+    }
+    region->prefaulted = region->capacity;
+  }
+  return region;
+}
+
+/* a region made of a block of parent, for child arenas */
+static mem_arena_region_t *_borrow_region(mem_arena_t *parent, size_t size) {
+  size = ALIGNED_SIZE(size);
+  mem_arena_region_t *region = mem_alloc(parent, size);
+  if (region) {
+    _init_region(region, size, REGION_BORROWED);
+  }
   return region;
 }
 
-mem_arena_t *mem_arena_new(size_t size) {
+/* a new region of arena, borrowed from the parent of a child arena */
+static mem_arena_region_t *_arena_new_region(mem_arena_t *arena,
+                                             size_t size) {
+  if (arena->parent) {
+    return _borrow_region(arena->parent, size);
+  }
+  return _new_region(size, arena->pagesize, arena->flags);
+}
+
+/* give a region of arena back, to the parent if it was borrowed */
+static void _arena_release_region(mem_arena_t *arena,
+                                  mem_arena_region_t *region) {
+  if (region->flags & REGION_BORROWED) {
+    mem_free(arena->parent, region);
+  } else {
+    _release_region(region);
+  }
+}
+
+/* set the arena up at the start of its first region */
+static mem_arena_t *_init_arena(mem_arena_region_t *region, size_t pagesize,
+                                size_t default_size, unsigned int flags) {
+  size_t head_size = ALIGNED_SIZE(sizeof(mem_arena_t));
+  mem_arena_t *arena = (mem_arena_t *)region->data;
+  memset(arena, 0, sizeof(*arena));
+
+  arena->head = region;
+  arena->tail = region;
+  arena->last = region;
+  arena->pagesize = pagesize;
+  arena->default_size = default_size;
+  arena->next_size = default_size;
+  arena->flags = flags;
+  STAT_REGION(arena, region);
+
+  region->flags |= REGION_ARENA;
+  region->data = (unsigned char *)region->data + head_size;
+  region->capacity -= head_size;
+  region->prefaulted -= region->prefaulted > head_size ? head_size
+                                                       : region->prefaulted;
+  region->dirty -= region->dirty > head_size ? head_size : region->dirty;
+  return arena;
+}
+
+mem_arena_t *mem_arena_new(size_t size) { return mem_arena_new_flags(size, 0); }
+
+mem_arena_t *mem_arena_new_flags(size_t size, unsigned int flags) {
   size_t pagesize = getpagesize();
   if (size == 0) {
     size = pagesize;
   }
-  mem_arena_t *arena = NULL;
-  mem_arena_region_t *region = _new_region(size + MIN_OVERHEAD_R0, pagesize);
-  if (region) {
-    size_t head_size = ALIGNED_SIZE(sizeof(*arena));
-    arena = (mem_arena_t *)region->data;
-    memset(arena, 0, sizeof(*arena));
-
-    arena->head = region;
-    arena->tail = region;
-    arena->pagesize = pagesize;
-    arena->default_size = size + MIN_OVERHEAD_RX;
+  /* regions, default one included, are made of whole huge pages */
+  size_t default_size = size + MIN_OVERHEAD_RX;
+  if (flags & MEM_ARENA_HUGEPAGE) {
+    pagesize = MEMARENA_HUGEPAGE_SIZE;
+    default_size =
+        ROUND_UP(default_size + MIN_OVERHEAD_RX, pagesize) - MIN_OVERHEAD_RX;
+  }
+  mem_arena_region_t *region =
+      _new_region(size + MIN_OVERHEAD_R0, pagesize, flags);
+  if (region == NULL) {
+    return NULL;
+  }
+  return _init_arena(region, pagesize, default_size, flags);
+}
 
-    region->data = (unsigned char *)region->data + head_size;
-    region->capacity -= head_size;
+mem_arena_t *mem_arena_new_child(mem_arena_t *parent, size_t size) {
+  if (parent == NULL || size > SIZE_MAX / 4) {
+    return NULL;
   }
+  size_t pagesize = getpagesize();
+  if (size == 0) {
+    size = pagesize;
+  }
+  mem_arena_region_t *region = _borrow_region(parent, size + MIN_OVERHEAD_R0);
+  if (region == NULL) {
+    return NULL;
+  }
+  mem_arena_t *arena =
+      _init_arena(region, pagesize, size + MIN_OVERHEAD_RX, 0);
+  arena->parent = parent;
   return arena;
 }
 
@@ -76,36 +473,199 @@ mem_arena_t *mem_arena_new_embed(size_t size, size_t embed_size, void **ptr) {
     *ptr = region->data;
     region->data += embed_size;
     region->capacity -= embed_size;
+    region->prefaulted -= region->prefaulted > embed_size
+                              ? embed_size
+                              : region->prefaulted;
+    region->dirty -= region->dirty > embed_size ? embed_size : region->dirty;
     arena->embed = embed_size;
   }
   return arena;
 }
 
+void mem_arena_stats(mem_arena_t *arena, mem_arena_stats_t *stats) {
+  if (arena == NULL || stats == NULL) {
+    return;
+  }
+  *stats = arena->stats;
+  stats->regions = 0;
+  stats->mapped = 0;
+  stats->capacity = 0;
+  stats->used = 0;
+  for (mem_arena_region_t *r = arena->head; r;
+       r = (mem_arena_region_t *)r->next) {
+    stats->regions++;
+    stats->mapped += REGION_MAPPED_SIZE(r);
+    stats->capacity += r->capacity;
+    stats->used += REGION_USED(r);
+  }
+  if (stats->used > arena->stats.peak) {
+    arena->stats.peak = stats->used;
+  }
+  stats->peak = arena->stats.peak;
+}
+
 void mem_arena_dump(mem_arena_t *arena) {
   if (arena) {
-    size_t total_size = 0;
-    size_t used_size = 0;
-    for (mem_arena_region_t *r = arena->head; r;
-         r = (mem_arena_region_t *)r->next) {
-      fprintf(stderr, "capacity %ld\n", r->capacity);
-      used_size += r->used;
-      total_size += r->capacity;
-    }
+    mem_arena_stats_t stats;
+    mem_arena_stats(arena, &stats);
 
     fprintf(stderr,
             "ARENA %p\n\t- Page size\t\t%6ld\n\t- Default size\t\t%6ld\n\t- "
-            "Total size\t\t%6ld\n\t- Used "
-            "size\t\t%6ld (%.2f %%)\n",
-            arena, arena->pagesize, arena->default_size, total_size, used_size,
-            (double)used_size * 100 / total_size);
+            "Mapped size\t\t%6ld\n\t- Total size\t\t%6ld\n\t- Used "
+            "size\t\t%6ld (%.2f %%)\n\t- Peak size\t\t%6ld\n\t- "
+            "Overhead\t\t%6ld\n\t- Regions\t\t%6ld\n",
+            arena, arena->pagesize, arena->default_size, stats.mapped,
+            stats.capacity, stats.used,
+            (double)stats.used * 100 / stats.capacity, stats.peak,
+            stats.overhead, stats.regions);
+    if (arena->growth_fn) {
+      fprintf(stderr, "\t- Growth\t\tcallback %p\n",
+              (void *)arena->growth_fn);
+    } else if (arena->growth_factor > 1) {
+      fprintf(stderr,
+              "\t- Growth\t\tx%u up to %ld\n\t- Next size\t\t%6ld\n",
+              arena->growth_factor, arena->growth_max, arena->next_size);
+    }
+    fprintf(stderr,
+            "\t- Allocs\t\t%6ld (%ld bytes)\n\t- Frees\t\t\t%6ld\n\t- "
+            "Reallocs\t\t%6ld (in place %ld, remap %ld, copy %ld)\n\t- "
+            "Mmaps\t\t\t%6ld\n\t- Size classes\n",
+            stats.allocs, stats.requested, stats.frees, stats.reallocs,
+            stats.reallocs_inplace, stats.reallocs_remap, stats.reallocs_copy,
+            stats.mmaps);
+    for (int i = 0; i < MEMARENA_STATS_CLASSES; i++) {
+      if (stats.histogram[i]) {
+        fprintf(stderr, "\t\t%s%6ld\t%6ld\n",
+                i == MEMARENA_STATS_CLASSES - 1 ? ">=" : "  ", 1L << i,
+                stats.histogram[i]);
+      }
+    }
     int i = 0;
     for (mem_arena_region_t *r = arena->head; r;
          r = (mem_arena_region_t *)r->next) {
 
       fprintf(stderr,
               "\t* REGION %d\n\t\t- Capacity\t%6ld\n\t\t- Used\t\t%6ld\n", i++,
-              r->capacity, r->used);
+              r->capacity, REGION_USED(r));
+    }
+  }
+}
+
+static void _bin_region(mem_arena_t *arena, mem_arena_region_t *region) {
+  int i = _bin_index(region->capacity);
+  region->bin = i;
+  region->bin_prev = NULL;
+  region->bin_next = arena->bins[i];
+  if (arena->bins[i]) {
+    arena->bins[i]->bin_prev = region;
+  }
+  arena->bins[i] = region;
+  arena->bin_mask |= (size_t)1 << i;
+}
+
+static void _unbin_region(mem_arena_t *arena, mem_arena_region_t *region) {
+  mem_arena_region_t *prev = (mem_arena_region_t *)region->bin_prev;
+  mem_arena_region_t *next = (mem_arena_region_t *)region->bin_next;
+  if (prev) {
+    prev->bin_next = next;
+  } else {
+    arena->bins[region->bin] = next;
+    if (next == NULL) {
+      arena->bin_mask &= ~((size_t)1 << region->bin);
+    }
+  }
+  if (next) {
+    next->bin_prev = prev;
+  }
+  region->bin = -1;
+  region->bin_next = NULL;
+  region->bin_prev = NULL;
+}
+
+/* Take an empty region with at least need bytes of capacity. The head of the
+ * bin need falls in is probed first (regions are mostly of the same size so it
+ * usually fits), otherwise any region of an upper bin is big enough and the
+ * smallest of these bins is used.
+ */
+static mem_arena_region_t *_take_spare_region(mem_arena_t *arena,
+                                              size_t need) {
+  int i = _bin_index(need);
+  mem_arena_region_t *region = NULL;
+  if (arena->bins[i] && arena->bins[i]->capacity >= need) {
+    region = arena->bins[i];
+  } else {
+    size_t mask = arena->bin_mask & ~(((size_t)2 << i) - 1);
+    if (mask) {
+      region = arena->bins[__builtin_ctzll((unsigned long long)mask)];
+    }
+  }
+  if (region) {
+    _unbin_region(arena, region);
+  }
+  return region;
+}
+
+/* *** Free lists *** */
+
+#define FREELIST_SMALL_MAX (MEMARENA_FREELIST_SMALL * MEMARENA_ALIGNMENT)
+#define FREELIST_NEXT(ptr) (*(void **)(ptr))
+
+/* list a freed block, its size becomes the room it has */
+static void _freelist_put(mem_arena_t *arena, mem_arena_block_t *block) {
+  size_t capacity = ALIGNED_SIZE(block->size);
+  void *ptr = (uint8_t *)block + HEADER_SIZE;
+  void **list = NULL;
+  if (capacity <= FREELIST_SMALL_MAX) {
+    list = &arena->free_small[capacity / MEMARENA_ALIGNMENT - 1];
+  } else {
+    int i = _bin_index(capacity);
+    list = &arena->free_large[i];
+    arena->free_mask |= (size_t)1 << i;
+  }
+  block->size = capacity;
+  FREELIST_NEXT(ptr) = *list;
+  *list = ptr;
+}
+
+/* a listed block with room for size, small ones are an exact fit, big ones
+ * come from the head of the list size falls in or from an upper list */
+static void *_freelist_take(mem_arena_t *arena, size_t size) {
+  size_t capacity = ALIGNED_SIZE(size);
+  void **list = NULL;
+  if (capacity <= FREELIST_SMALL_MAX) {
+    list = &arena->free_small[capacity / MEMARENA_ALIGNMENT - 1];
+    if (*list == NULL) {
+      return NULL;
     }
+  } else {
+    int i = _bin_index(capacity);
+    void *head = arena->free_large[i];
+    if (head == NULL || GET_BLOCK_FROM_PTR(head)->size < capacity) {
+      size_t mask = arena->free_mask & ~(((size_t)2 << i) - 1);
+      if (mask == 0) {
+        return NULL;
+      }
+      i = __builtin_ctzll((unsigned long long)mask);
+    }
+    list = &arena->free_large[i];
+    if (FREELIST_NEXT(*list) == NULL) {
+      arena->free_mask &= ~((size_t)1 << i);
+    }
+  }
+  void *ptr = *list;
+  *list = FREELIST_NEXT(ptr);
+  mem_arena_block_t *block = GET_BLOCK_FROM_PTR(ptr);
+  STAT_ALLOC(arena, size, block->size + HEADER_SIZE - size);
+  STAT_ADD(arena, reuses, 1);
+  block->size = size;
+  return ptr;
+}
+
+static void _freelist_clear(mem_arena_t *arena) {
+  if (arena->flags & MEM_ARENA_FREELIST) {
+    memset(arena->free_small, 0, sizeof(arena->free_small));
+    memset(arena->free_large, 0, sizeof(arena->free_large));
+    arena->free_mask = 0;
   }
 }
 
@@ -119,10 +679,25 @@ void mem_arena_reset(mem_arena_t *arena) {
   }
 
   arena->tail = arena->head;
+  arena->bin_mask = 0;
+  memset(arena->bins, 0, sizeof(arena->bins));
+  arena->stats.used = 0;
+  arena->generation++;
+  _freelist_clear(arena);
+  /* concurrent allocation only maintains next, rebuild prev and last */
+  mem_arena_region_t *prev = NULL;
   for (mem_arena_region_t *r = arena->head; r;
        r = (mem_arena_region_t *)r->next) {
+    r->prev = prev;
+    arena->last = prev = r;
+    _region_dirty(r);
     r->used = 0;
     r->alloc_cnt = 0;
+    r->last_alloc = NULL;
+    r->bin = -1;
+    if (r != arena->head && !(arena->flags & MEM_ARENA_CONCURRENT)) {
+      _bin_region(arena, r);
+    }
   }
 }
 
@@ -130,174 +705,1557 @@ void mem_arena_destroy(mem_arena_t *arena) {
   if (arena == NULL) {
     return;
   }
-  size_t arena_head_size = ALIGNED_SIZE(sizeof(*arena)) + arena->embed;
-  size_t head_size = ALIGNED_SIZE(sizeof(mem_arena_region_t));
+  if (arena->parent) {
+    /* blocks of the parent, latest first so the last one gives its space
+     * back, the one holding the arena at the end */
+    mem_arena_t *parent = arena->parent;
+    mem_arena_region_t *holder = NULL;
+    for (mem_arena_region_t *r = arena->last; r != NULL;) {
+      mem_arena_region_t *p = (mem_arena_region_t *)r->prev;
+      if (r->flags & REGION_ARENA) {
+        holder = r;
+      } else {
+        mem_free(parent, r);
+      }
+      r = p;
+    }
+    mem_free(parent, holder);
+    return;
+  }
+  /* arena struct lives within one of the region, don't touch it once we
+   * started to unmap */
   for (mem_arena_region_t *r = arena->head; r != NULL;) {
     mem_arena_region_t *n = (mem_arena_region_t *)r->next;
-    munmap(r->data - (head_size + arena_head_size),
-           r->capacity + head_size + arena_head_size);
-    /* we embed arena struct within first region, so next region have no arena
-     * head size */
-    arena_head_size = 0;
+    _release_region(r);
     r = n;
   }
 }
 
-/* TODO : take care of INT_MAX ... */
-void *mem_alloc(mem_arena_t *arena, size_t size) {
-  if (!arena || size < 1) {
-    return NULL;
+static void _unlink_region(mem_arena_t *arena, mem_arena_region_t *region) {
+  mem_arena_region_t *prev = (mem_arena_region_t *)region->prev;
+  mem_arena_region_t *next = (mem_arena_region_t *)region->next;
+  if (prev) {
+    prev->next = next;
+  } else {
+    arena->head = next;
   }
-  mem_arena_region_t *region = NULL;
-  mem_arena_region_t *previous = NULL;
+  if (next) {
+    next->prev = prev;
+  } else {
+    arena->last = prev;
+  }
+  region->next = NULL;
+  region->prev = NULL;
+}
 
-  region = arena->tail;
-  while (region != NULL &&
-         REGION_FREE_SPACE(region) < size + ALIGNED_SIZE(sizeof(size_t))) {
-    previous = region;
-    region = (mem_arena_region_t *)region->next;
+static void _append_region(mem_arena_t *arena, mem_arena_region_t *region) {
+  region->next = NULL;
+  region->prev = arena->last;
+  if (arena->last) {
+    arena->last->next = region;
+  } else {
+    arena->head = region;
   }
+  arena->last = region;
+}
 
-  if (region == NULL) {
-    region =
-        _new_region((arena->default_size < size ? size : arena->default_size) +
-                        MIN_OVERHEAD_RX,
-                    arena->pagesize);
+static void _insert_region_after(mem_arena_t *arena, mem_arena_region_t *pos,
+                                 mem_arena_region_t *region) {
+  region->prev = pos;
+  region->next = pos->next;
+  if (pos->next) {
+    ((mem_arena_region_t *)pos->next)->prev = region;
+  } else {
+    arena->last = region;
   }
+  pos->next = region;
+}
 
-  uint8_t *ptr = NULL;
-  if (region) {
-    *(size_t *)(region->data + region->used) = size;
-    ptr = region->data + region->used + ALIGNED_SIZE(sizeof(size_t));
-    region->used += size + ALIGNED_SIZE(sizeof(size_t));
-    region->last_alloc = ptr;
-    region->alloc_cnt++;
-    arena->tail = region;
-    if (previous) {
-      previous->next = region;
-    }
+void mem_arena_set_trim(mem_arena_t *arena, size_t retain,
+                        unsigned int policy) {
+  if (arena == NULL) {
+    return;
   }
-  return (void *)ptr;
+  arena->trim_retain = retain;
+  arena->trim_policy = policy;
 }
 
-void *mem_realloc(mem_arena_t *arena, void *ptr, size_t new_size) {
-  if (arena == NULL || new_size < 1) {
-    return NULL;
+/* give back to the system the pages of [start, end), returns 1 when they
+ * are zero now. MADV_FREE ones keep their content until reclaimed. */
+static int _advise_pages(mem_arena_t *arena, uint8_t *start, uint8_t *end) {
+  start = (uint8_t *)ROUND_UP((uintptr_t)start, arena->pagesize);
+  if (start >= end) {
+    return 0;
   }
-  if (ptr == NULL) {
-    return mem_alloc(arena, new_size);
+#ifdef MADV_FREE
+  if (arena->trim_policy & MEM_TRIM_FREE) {
+    madvise(start, end - start, MADV_FREE);
+    return 0;
   }
+#endif /* MADV_FREE */
+  return madvise(start, end - start, MADV_DONTNEED) == 0;
+}
 
-  size_t *old_size = GET_SIZE_T_PTR_FROM_PTR(ptr);
-  if (*old_size > new_size) {
-    *old_size = new_size;
-    return ptr;
+void mem_arena_reset_trim(mem_arena_t *arena) {
+  if (arena == NULL || arena->head == NULL) {
+    return;
   }
 
+  size_t used = 0;
   for (mem_arena_region_t *r = arena->head; r;
        r = (mem_arena_region_t *)r->next) {
-    if (r->last_alloc == ptr && REGION_FREE_SPACE(r) >= new_size - *old_size) {
-      r->used += new_size - *old_size;
-      *old_size = new_size;
-      return ptr;
-    }
+    used += REGION_USED(r);
+  }
+  /* high water mark loses a quarter each reset unless usage keeps it up */
+  arena->high_water -= (arena->high_water + 3) / 4;
+  if (used > arena->high_water) {
+    arena->high_water = used;
   }
+  size_t keep =
+      arena->high_water > arena->trim_retain ? arena->high_water
+                                             : arena->trim_retain;
 
-  void *new_ptr = mem_alloc(arena, new_size);
-  if (new_ptr) {
-    memcpy(new_ptr, ptr, *old_size);
+  mem_arena_reset(arena);
+
+  size_t kept = 0;
+  for (mem_arena_region_t *r = arena->head; r;) {
+    mem_arena_region_t *next = (mem_arena_region_t *)r->next;
+    if (kept >= keep && !(r->flags & REGION_ARENA) &&
+        (arena->trim_policy & MEM_TRIM_UNMAP)) {
+      /* surplus region, the one holding the arena stays */
+      if (r->bin >= 0) {
+        _unbin_region(arena, r);
+      }
+      _unlink_region(arena, r);
+      _arena_release_region(arena, r);
+    } else if (kept + r->capacity > keep && !(r->flags & REGION_BORROWED)) {
+      uint8_t *end = (uint8_t *)r + REGION_MAPPED_SIZE(r);
+      size_t retained = keep > kept ? keep - kept : 0;
+      if (_advise_pages(arena, r->data + retained, end)) {
+        /* MADV_DONTNEED pages read back as zero */
+        size_t zero = ROUND_UP((uintptr_t)r->data + retained, arena->pagesize) -
+                      (uintptr_t)r->data;
+        if (r->dirty > zero) {
+          r->dirty = zero;
+        }
+      }
+      if (r->prefaulted > retained) {
+        r->prefaulted = retained;
+      }
+      kept += r->capacity;
+    } else {
+      kept += r->capacity;
+    }
+    r = next;
   }
-  return new_ptr;
 }
 
-/* TODO : think if I should have a pointer in the region to point to the
- * real tail, so I skip going through some region to move it to the end. If
- * so, do this modification ... but I wonder about adding more pointer.
- */
-static void _move_empty_region_to_end(mem_arena_t *arena,
-                                      mem_arena_region_t *region,
-                                      mem_arena_region_t *prev) {
-  /* alread tail so we done */
-  if (arena->tail == region) {
+void mem_arena_set_growth(mem_arena_t *arena, unsigned int factor,
+                          size_t max) {
+  if (arena == NULL) {
     return;
   }
+  arena->growth_factor = factor;
+  arena->growth_max = max;
+  arena->growth_fn = NULL;
+  arena->growth_data = NULL;
+}
 
-  /* it's the only region so it gets reused next alloc */
-  if (region == arena->head && region->next == NULL) {
-    if (arena->tail != region && arena->tail != NULL) {
-      arena->tail->next = region;
-    }
-    arena->tail = region;
+void mem_arena_set_growth_fn(mem_arena_t *arena, mem_arena_growth_fn fn,
+                             void *data) {
+  if (arena == NULL) {
     return;
   }
+  arena->growth_fn = fn;
+  arena->growth_data = data;
+}
 
-  /* disconnect region */
-  if (prev) {
-    prev->next = region->next;
+/* mapping size for a new region holding at least need bytes */
+static size_t _region_size(mem_arena_t *arena, size_t need) {
+  size_t size = __atomic_load_n(&arena->next_size, __ATOMIC_RELAXED);
+  if (arena->growth_fn) {
+    size = arena->growth_fn(arena, need, arena->growth_data);
   }
-  region->next = NULL;
-
-  /* put region after tail so it can get picked for allocation */
-  mem_arena_region_t *tail = arena->tail;
-  while (tail->next != NULL) {
-    tail = tail->next;
+  if (size < need) {
+    size = need;
   }
-  tail->next = region;
-
-  if (region == arena->head) {
-    arena->head = region->next;
+  /* no mapping can be that big, it fails below instead of wrapping around
+   * to a tiny one */
+  if (size > SIZE_MAX / 2) {
+    size = SIZE_MAX / 2;
   }
+  return size + MIN_OVERHEAD_RX;
 }
 
-void mem_free(mem_arena_t *arena, void *ptr) {
-  if (arena == NULL || ptr == NULL) {
+/* a new region was mapped, next one is bigger */
+static void _region_grown(mem_arena_t *arena) {
+  if (arena->growth_factor <= 1 || arena->growth_fn) {
     return;
   }
+  size_t next = __atomic_load_n(&arena->next_size, __ATOMIC_RELAXED);
+  if (next < arena->growth_max) {
+    next = next > arena->growth_max / arena->growth_factor
+               ? arena->growth_max
+               : next * arena->growth_factor;
+    __atomic_store_n(&arena->next_size, next, __ATOMIC_RELAXED);
+  }
+}
 
-  mem_arena_region_t *region = arena->head, *prev = NULL;
-
-  /* find which region pointer belong */
-  while (region != NULL && !(ptr >= (void *)region->data &&
-                             ptr < (void *)(region->data + region->used))) {
-    prev = region;
-    region = (mem_arena_region_t *)region->next;
+mem_arena_mark_t mem_arena_mark(mem_arena_t *arena) {
+  mem_arena_mark_t mark = {0};
+  if (arena == NULL) {
+    return mark;
   }
-  /* ptr doesn't belong to us */
-  if (region == NULL) {
+  mem_arena_region_t *region = arena->tail;
+  mark.region = region;
+  mark.region_id = region->id;
+  mark.used = region->used;
+  mark.alloc_cnt = region->alloc_cnt;
+  mark.last_alloc =
+      region->last_alloc ? (size_t)(region->last_alloc - region->data) : 0;
+  return mark;
+}
+
+void mem_arena_rewind(mem_arena_t *arena, mem_arena_mark_t mark) {
+  if (arena == NULL || mark.region == NULL) {
     return;
   }
 
-  if (region->last_alloc == ptr) {
-    size_t *old_size = GET_SIZE_T_PTR_FROM_PTR(ptr);
-    /* use count the head size, so we should remove it */
-    region->used -= (*old_size + ALIGNED_SIZE(sizeof(size_t)));
-    region->alloc_cnt--;
-    region->last_alloc = NULL;
-    if (region->alloc_cnt <= 0) {
-      _move_empty_region_to_end(arena, region, prev);
+  mem_arena_region_t *region = NULL;
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    /* regions never move nor get recycled, every region after the marked one
+     * was used after the mark or is an empty one */
+    region = mark.region;
+    for (mem_arena_region_t *r = (mem_arena_region_t *)region->next; r;
+         r = (mem_arena_region_t *)r->next) {
+      _region_dirty(r);
+      r->used = 0;
     }
-    return;
+  } else {
+    /* regions used since the mark are from tail back to the marked one, a
+     * region gets a new id when it's reused so theirs are higher. Matched by
+     * id as mremap may have moved the marked one. */
+    for (region = arena->tail; region && region->id > mark.region_id;
+         region = (mem_arena_region_t *)region->prev) {
+      STAT_USED(arena, region->used, 0);
+      _region_dirty(region);
+      region->used = 0;
+      region->alloc_cnt = 0;
+      region->last_alloc = NULL;
+      if (region->bin < 0) {
+        _bin_region(arena, region);
+      }
+    }
+    if (region == NULL || region->id != mark.region_id) {
+      /* the marked region was emptied after the mark and moved after tail,
+       * the ones before it are left as they are */
+      _freelist_clear(arena);
+      if (region == NULL) {
+        region = arena->head;
+        _unbin_region(arena, region);
+      }
+      arena->tail = region;
+      return;
+    }
+    STAT_USED(arena, region->used, mark.used);
   }
 
-  region->alloc_cnt--;
-  if (region->alloc_cnt <= 0) {
-    region->alloc_cnt = 0;
-    region->used = 0;
-    _move_empty_region_to_end(arena, region, prev);
+  /* listed blocks may be in the released space */
+  _freelist_clear(arena);
+  _region_dirty(region);
+  region->used = mark.used;
+  region->alloc_cnt = mark.alloc_cnt;
+  region->last_alloc = mark.last_alloc ? region->data + mark.last_alloc : NULL;
+  arena->tail = region;
+}
+
+/* Make room for need bytes when tail is full. Regions after tail are empty
+ * ones, waiting in bins, reuse one of them or get a new one. In both case it
+ * goes right after tail and become the new tail.
+ */
+static mem_arena_region_t *_next_region(mem_arena_t *arena, size_t need) {
+  mem_arena_region_t *region = _take_spare_region(arena, need);
+  if (region) {
+    _unlink_region(arena, region);
+    /* used anew, it's after any mark taken so far (see mem_arena_rewind) */
+    region->id = __atomic_add_fetch(&_region_ids, 1, __ATOMIC_RELAXED);
+  } else {
+    region = _arena_new_region(arena, _region_size(arena, need));
+    if (region == NULL) {
+      return NULL;
+    }
+    STAT_REGION(arena, region);
+    _region_grown(arena);
   }
+  _insert_region_after(arena, arena->tail, region);
+  arena->tail = region;
+  return region;
 }
 
-/* *** String function *** */
+/* Move tail forward once region is full. The next region is either one
+ * already in the chain or a new one we try to publish with a CAS, losing the
+ * race just means someone else did the job.
+ */
+static int _advance_tail_concurrent(mem_arena_t *arena,
+                                    mem_arena_region_t *region) {
+  mem_arena_region_t *next = __atomic_load_n(
+      (mem_arena_region_t **)&region->next, __ATOMIC_ACQUIRE);
+  if (next == NULL) {
+    mem_arena_region_t *new_region =
+        _new_region(_region_size(arena, arena->default_size), arena->pagesize,
+                    arena->flags);
+    if (new_region == NULL) {
+      return -1;
+    }
+    if (__atomic_compare_exchange_n((mem_arena_region_t **)&region->next,
+                                    &next, new_region, 0, __ATOMIC_RELEASE,
+                                    __ATOMIC_ACQUIRE)) {
+      next = new_region;
+      STAT_REGION(arena, new_region);
+      _region_grown(arena);
+    } else {
+      _release_region(new_region);
+    }
+  }
+  __atomic_compare_exchange_n(&arena->tail, &region, next, 0,
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  return 0;
+}
 
-char *mem_strndup(mem_arena_t *arena, const char *string, size_t length) {
-  if (arena == NULL || string == NULL || length == 0) {
-    return NULL;
+/* Lock free allocation. Bump is a fetch add on tail used, whoever goes past
+ * capacity lost and moves tail forward (used is left past capacity until
+ * reset). Request bigger than default size get their own region, linked
+ * right after tail without becoming tail. Alignment above the default one is
+ * obtained by reserving the worst case padding.
+ */
+static void *_alloc_concurrent(mem_arena_t *arena, size_t size, size_t header,
+                               size_t align) {
+  size_t need = ALIGNED_SIZE(size) + header + _align_padding(align);
+  mem_arena_region_t *region = NULL;
+  size_t start = 0;
+  if (need > arena->default_size) {
+    region = _new_region(need + MIN_OVERHEAD_RX, arena->pagesize, arena->flags);
+    if (region == NULL) {
+      return NULL;
+    }
+    STAT_REGION(arena, region);
+    region->used = need;
+    mem_arena_region_t *tail =
+        __atomic_load_n(&arena->tail, __ATOMIC_ACQUIRE);
+    mem_arena_region_t *next = __atomic_load_n(
+        (mem_arena_region_t **)&tail->next, __ATOMIC_ACQUIRE);
+    do {
+      region->next = next;
+    } while (!__atomic_compare_exchange_n((mem_arena_region_t **)&tail->next,
+                                          &next, region, 0, __ATOMIC_RELEASE,
+                                          __ATOMIC_ACQUIRE));
+  } else {
+    for (;;) {
+      region = __atomic_load_n(&arena->tail, __ATOMIC_ACQUIRE);
+      start = __atomic_fetch_add(&region->used, need, __ATOMIC_RELAXED);
+      if (start + need <= region->capacity) {
+        break;
+      }
+      if (_advance_tail_concurrent(arena, region) != 0) {
+        return NULL;
+      }
+    }
   }
 
-  size_t slen = strlen(string);
-  if (slen < length) {
-    length = slen;
+  STAT_ALLOC(arena, size, need - size);
+  if (header == 0) {
+    return region->data + start;
   }
+  uint8_t *ptr = region->data + start + header;
+  ptr = (uint8_t *)ROUND_UP_POW2((uintptr_t)ptr, align);
+  mem_arena_block_t *block = (mem_arena_block_t *)(ptr - header);
+  block->size = size;
+  block->region = region;
+  return (uint8_t *)block + header;
+}
+
+/* *** Prefault *** */
+
+static void _prefault_slow(mem_arena_t *arena, mem_arena_region_t *region) {
+  size_t start = region->prefaulted > region->used ? region->prefaulted
+                                                   : region->used;
+  size_t end = region->used + arena->prefault_ahead;
+  if (end > region->capacity || end < region->used) {
+    end = region->capacity;
+  }
+  _populate(region->data + start, region->data + end);
+  region->prefaulted = end;
+}
+
+/* called after a bump, populates the next window when used gets within half
+ * of it */
+static inline void _prefault(mem_arena_t *arena, mem_arena_region_t *region) {
+  if (arena->prefault_ahead &&
+      region->used + arena->prefault_ahead / 2 > region->prefaulted &&
+      region->prefaulted < region->capacity) {
+    _prefault_slow(arena, region);
+  }
+}
+
+void mem_arena_set_prefault(mem_arena_t *arena, size_t ahead) {
+  if (arena == NULL) {
+    return;
+  }
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    return;
+  }
+  arena->prefault_ahead = ahead;
+  _prefault(arena, arena->tail);
+}
+
+int mem_arena_prewarm(mem_arena_t *arena, size_t size) {
+  if (arena == NULL) {
+    return -1;
+  }
+  size_t capacity = 0;
+  mem_arena_region_t *last = NULL;
+  for (mem_arena_region_t *r = arena->head; r;
+       r = (mem_arena_region_t *)r->next) {
+    capacity += r->capacity;
+    last = r;
+  }
+  if (capacity < size) {
+    /* one empty region for the rest, waiting after tail like a freed one.
+     * Linked after the real end, concurrent arenas don't maintain last */
+    mem_arena_region_t *region =
+        _arena_new_region(arena, _region_size(arena, size - capacity));
+    if (region == NULL) {
+      return -1;
+    }
+    STAT_REGION(arena, region);
+    region->prev = last;
+    last->next = region;
+    arena->last = region;
+    if (!(arena->flags & MEM_ARENA_CONCURRENT)) {
+      _bin_region(arena, region);
+    }
+  }
+  for (mem_arena_region_t *r = arena->head; r;
+       r = (mem_arena_region_t *)r->next) {
+    size_t start = r->prefaulted > r->used ? r->prefaulted : r->used;
+    _populate(r->data + start, r->data + r->capacity);
+    r->prefaulted = r->capacity;
+  }
+  return 0;
+}
+
+void *mem_alloc(mem_arena_t *arena, size_t size) {
+  if (!arena || size < 1 || size > SIZE_MAX / 2) {
+    return NULL;
+  }
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    return _alloc_concurrent(arena, size, HEADER_SIZE, MEMARENA_ALIGNMENT);
+  }
+  if (arena->flags & MEM_ARENA_FREELIST) {
+    void *ptr = _freelist_take(arena, size);
+    if (ptr) {
+      return ptr;
+    }
+  }
+  size_t need = ALIGNED_SIZE(size) + HEADER_SIZE;
+  mem_arena_region_t *region = arena->tail;
+  if (REGION_FREE_SPACE(region) < need) {
+    region = _next_region(arena, need);
+    if (region == NULL) {
+      return NULL;
+    }
+  }
+
+  size_t start = ALIGNED_SIZE(region->used);
+  mem_arena_block_t *block = (mem_arena_block_t *)(region->data + start);
+  block->size = size;
+  block->region = region;
+  uint8_t *ptr = (uint8_t *)block + HEADER_SIZE;
+  STAT_ALLOC(arena, size, start + need - region->used - size);
+  STAT_USED(arena, region->used, start + need);
+  region->used = start + need;
+  region->last_alloc = ptr;
+  region->alloc_cnt++;
+  _prefault(arena, region);
+  return (void *)ptr;
+}
+
+void *mem_alloc_aligned(mem_arena_t *arena, size_t size, size_t align) {
+  if (align == 0 || (align & (align - 1)) != 0) {
+    return NULL;
+  }
+  if (align <= MEMARENA_ALIGNMENT) {
+    return mem_alloc(arena, size);
+  }
+  if (!arena || size < 1 || size > SIZE_MAX / 2 || align > SIZE_MAX / 4) {
+    return NULL;
+  }
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    return _alloc_concurrent(arena, size, HEADER_SIZE, align);
+  }
+  /* padding goes before the header, so it stays right before the pointer */
+  mem_arena_region_t *region = arena->tail;
+  uint8_t *ptr = region->data + ALIGNED_SIZE(region->used) + HEADER_SIZE;
+  ptr = (uint8_t *)ROUND_UP_POW2((uintptr_t)ptr, align);
+  size_t end = (size_t)(ptr - region->data) + ALIGNED_SIZE(size);
+  if (end > region->capacity) {
+    region = _next_region(
+        arena, HEADER_SIZE + ALIGNED_SIZE(size) + _align_padding(align));
+    if (region == NULL) {
+      return NULL;
+    }
+    ptr = (uint8_t *)ROUND_UP_POW2((uintptr_t)region->data + HEADER_SIZE,
+                                   align);
+    end = (size_t)(ptr - region->data) + ALIGNED_SIZE(size);
+  }
+
+  mem_arena_block_t *block = GET_BLOCK_FROM_PTR(ptr);
+  block->size = size;
+  block->region = region;
+  STAT_ALLOC(arena, size, end - region->used - size);
+  STAT_USED(arena, region->used, end);
+  region->used = end;
+  region->last_alloc = ptr;
+  region->alloc_cnt++;
+  _prefault(arena, region);
+  return (void *)ptr;
+}
+
+static void *_alloc_nohdr_slow(mem_arena_t *arena, size_t size) {
+  mem_arena_region_t *region = _next_region(arena, ALIGNED_SIZE(size));
+  if (region == NULL) {
+    return NULL;
+  }
+  /* fresh region, data is aligned */
+  void *ptr = region->data;
+  STAT_ALLOC(arena, size, 0);
+  STAT_USED(arena, 0, size);
+  region->used = size;
+  region->last_alloc = NULL;
+  region->alloc_cnt++;
+  _prefault(arena, region);
+  return ptr;
+}
+
+void *mem_alloc_nohdr(mem_arena_t *arena, size_t size) {
+  if (!arena || size < 1 || size > SIZE_MAX / 2) {
+    return NULL;
+  }
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    return _alloc_concurrent(arena, size, 0, MEMARENA_ALIGNMENT);
+  }
+  /* natural alignment of an object is a power of two dividing its size, so
+   * the lowest bit set is enough */
+  size_t align = size & (~size + 1);
+  if (align > MEMARENA_ALIGNMENT) {
+    align = MEMARENA_ALIGNMENT;
+  }
+  mem_arena_region_t *region = arena->tail;
+  size_t start = (region->used + align - 1) & ~(align - 1);
+  if (__builtin_expect(start + size > region->capacity, 0)) {
+    return _alloc_nohdr_slow(arena, size);
+  }
+  STAT_ALLOC(arena, size, start - region->used);
+  STAT_USED(arena, region->used, start + size);
+  region->used = start + size;
+  /* nothing can be extended over this block and the region must not be
+   * recycled by mem_free while it lives */
+  region->last_alloc = NULL;
+  region->alloc_cnt++;
+  _prefault(arena, region);
+  return region->data + start;
+}
+
+/* Grow a block which is alone in its region, and at its start, by growing the
+ * mapping itself. The kernel moves page tables, the data is not copied. The
+ * region holding the arena can't move, nor reserved huge pages be remapped.
+ */
+static void *_realloc_remap(mem_arena_t *arena, mem_arena_block_t *block,
+                            size_t new_size) {
+  mem_arena_region_t *r = block->region;
+  /* the region holding the arena must not move, it's not always head */
+  if ((r->flags & (REGION_ARENA | REGION_HUGETLB | REGION_BORROWED)) ||
+      (uint8_t *)block != r->data || r->alloc_cnt != 1) {
+    return NULL;
+  }
+  size_t head_size = (size_t)(r->data - (uint8_t *)r);
+  size_t old_mapped = REGION_MAPPED_SIZE(r);
+  size_t mapped = ROUND_UP(head_size + HEADER_SIZE + ALIGNED_SIZE(new_size),
+                           arena->pagesize);
+  /* in place if the following address space is free, else move it */
+  mem_arena_region_t *n = mremap(r, old_mapped, mapped, 0);
+  if (n == MAP_FAILED) {
+    n = mremap(r, old_mapped, mapped, MREMAP_MAYMOVE);
+    if (n == MAP_FAILED) {
+      return NULL;
+    }
+  }
+  if (n != r) {
+    /* fix everything pointing to the region, being in use it's not binned */
+    n->data = (uint8_t *)n + head_size;
+    if (n->prev) {
+      ((mem_arena_region_t *)n->prev)->next = n;
+    } else {
+      arena->head = n;
+    }
+    if (n->next) {
+      ((mem_arena_region_t *)n->next)->prev = n;
+    } else {
+      arena->last = n;
+    }
+    if (arena->tail == r) {
+      arena->tail = n;
+    }
+    block = (mem_arena_block_t *)n->data;
+    block->region = n;
+    n->last_alloc = n->data + HEADER_SIZE;
+  }
+  n->capacity = mapped - head_size;
+  STAT_USED(arena, n->used, HEADER_SIZE + ALIGNED_SIZE(new_size));
+  n->used = HEADER_SIZE + ALIGNED_SIZE(new_size);
+  block->size = new_size;
+  return n->data + HEADER_SIZE;
+}
+
+/* Realloc to a block aligned on align. A block not aligned yet is moved,
+ * mremap keeps the offset in the page so it's only used up to page alignment.
+ */
+static void *_realloc(mem_arena_t *arena, void *ptr, size_t new_size,
+                      size_t align) {
+  if (arena == NULL || new_size < 1 || new_size > SIZE_MAX / 2) {
+    return NULL;
+  }
+  if (ptr == NULL) {
+    return mem_alloc_aligned(arena, new_size, align);
+  }
+
+  STAT_ADD(arena, reallocs, 1);
+  mem_arena_block_t *block = GET_BLOCK_FROM_PTR(ptr);
+  int aligned = ((uintptr_t)ptr & (align - 1)) == 0;
+  /* last allocation of its region, resize in place if there's room. Never
+   * for concurrent arena as last_alloc isn't tracked. */
+  mem_arena_region_t *r = block->region;
+  size_t offset = (size_t)((uint8_t *)ptr - r->data);
+  if (aligned && block->size >= new_size) {
+    STAT_ADD(arena, reallocs_inplace, 1);
+    if (r->last_alloc == ptr) {
+      /* give the end back */
+      STAT_USED(arena, r->used, offset + ALIGNED_SIZE(new_size));
+      _region_dirty(r);
+      r->used = offset + ALIGNED_SIZE(new_size);
+    }
+    block->size = new_size;
+    return ptr;
+  }
+
+  if (aligned && r->last_alloc == ptr &&
+      r->capacity - offset >= ALIGNED_SIZE(new_size)) {
+    STAT_ADD(arena, reallocs_inplace, 1);
+    STAT_USED(arena, r->used, offset + ALIGNED_SIZE(new_size));
+    r->used = offset + ALIGNED_SIZE(new_size);
+    block->size = new_size;
+    _prefault(arena, r);
+    return ptr;
+  }
+
+  if (aligned && r->last_alloc == ptr && align <= arena->pagesize) {
+    void *new_ptr = _realloc_remap(arena, block, new_size);
+    if (new_ptr) {
+      STAT_ADD(arena, reallocs_remap, 1);
+      return new_ptr;
+    }
+  }
+
+  void *new_ptr = mem_alloc_aligned(arena, new_size, align);
+  if (new_ptr) {
+    STAT_ADD(arena, reallocs_copy, 1);
+    memcpy(new_ptr, ptr, block->size);
+    if (arena->flags & MEM_ARENA_FREELIST) {
+      mem_free(arena, ptr);
+    }
+  }
+  return new_ptr;
+}
+
+void *mem_realloc(mem_arena_t *arena, void *ptr, size_t new_size) {
+  return _realloc(arena, ptr, new_size, MEMARENA_ALIGNMENT);
+}
+
+/* zero size bytes at ptr, within region. Bumped bytes are cleared only
+ * below the dirty mark, above it they were never handed out. */
+static void _zero(mem_arena_t *arena, mem_arena_region_t *region, void *ptr,
+                  size_t size, int bumped) {
+  if (bumped && !(arena->flags & MEM_ARENA_CONCURRENT)) {
+    size_t offset = (size_t)((uint8_t *)ptr - region->data);
+    size_t dirty = region->dirty > offset ? region->dirty - offset : 0;
+    if (dirty < size) {
+      size = dirty;
+    }
+  }
+  /* libc memset is vectorized and goes non temporal for big sizes */
+  memset(ptr, 0, size);
+}
+
+void *mem_calloc(mem_arena_t *arena, size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / 2 / size) {
+    return NULL;
+  }
+  size *= count;
+  if (arena && (arena->flags & MEM_ARENA_FREELIST) && size > 0 &&
+      !(arena->flags & MEM_ARENA_CONCURRENT)) {
+    /* a listed block was used */
+    void *ptr = _freelist_take(arena, size);
+    if (ptr) {
+      memset(ptr, 0, size);
+      return ptr;
+    }
+  }
+  void *ptr = mem_alloc(arena, size);
+  if (ptr) {
+    _zero(arena, GET_BLOCK_FROM_PTR(ptr)->region, ptr, size, 1);
+  }
+  return ptr;
+}
+
+void *mem_realloc_zero(mem_arena_t *arena, void *ptr, size_t new_size) {
+  size_t old_size = ptr ? GET_BLOCK_FROM_PTR(ptr)->size : 0;
+  uint8_t *new_ptr = _realloc(arena, ptr, new_size, MEMARENA_ALIGNMENT);
+  if (new_ptr && new_size > old_size) {
+    /* a moved block may come from the free lists */
+    _zero(arena, GET_BLOCK_FROM_PTR(new_ptr)->region, new_ptr + old_size,
+          new_size - old_size, !(arena->flags & MEM_ARENA_FREELIST));
+  }
+  return new_ptr;
+}
+
+void *mem_realloc_aligned(mem_arena_t *arena, void *ptr, size_t new_size,
+                          size_t align) {
+  if (align == 0 || (align & (align - 1)) != 0) {
+    return NULL;
+  }
+  return _realloc(arena, ptr, new_size, align);
+}
+
+static void _move_empty_region_to_end(mem_arena_t *arena,
+                                      mem_arena_region_t *region) {
+  /* alread tail or already waiting in a bin so we done */
+  if (arena->tail == region || region->bin >= 0) {
+    return;
+  }
+
+  /* put region at the end, after tail, so it can get picked for allocation */
+  _unlink_region(arena, region);
+  _append_region(arena, region);
+  _bin_region(arena, region);
+}
+
+void mem_free(mem_arena_t *arena, void *ptr) {
+  if (arena == NULL || ptr == NULL) {
+    return;
+  }
+  STAT_ADD(arena, frees, 1);
+  /* alloc_cnt and last_alloc are not tracked, so nothing to reclaim */
+  if (arena->flags & MEM_ARENA_CONCURRENT) {
+    return;
+  }
+
+  mem_arena_block_t *block = GET_BLOCK_FROM_PTR(ptr);
+  mem_arena_region_t *region = block->region;
+  /* ptr doesn't belong to us (or was already freed) */
+  if (region == NULL || !((uint8_t *)ptr > region->data &&
+                          (uint8_t *)ptr < region->data + region->used)) {
+    return;
+  }
+
+  if (region->last_alloc == ptr) {
+    /* give back the space, header included */
+    STAT_USED(arena, region->used, (uint8_t *)block - region->data);
+    _region_dirty(region);
+    region->used = (size_t)((uint8_t *)block - region->data);
+    region->last_alloc = NULL;
+  } else if (arena->flags & MEM_ARENA_FREELIST) {
+    /* stays counted in alloc_cnt, the region must not be recycled under the
+     * list */
+    _freelist_put(arena, block);
+    return;
+  }
+
+  region->alloc_cnt--;
+  if (region->alloc_cnt <= 0) {
+    region->alloc_cnt = 0;
+    STAT_USED(arena, region->used, 0);
+    _region_dirty(region);
+    region->used = 0;
+    region->last_alloc = NULL;
+    _move_empty_region_to_end(arena, region);
+  }
+}
+
+/* *** Vector *** */
+
+void mem_vec_init(mem_vec_t *vec, mem_arena_t *arena, size_t elem_size) {
+  assert(vec != NULL && arena != NULL && elem_size > 0);
+  vec->arena = arena;
+  vec->data = NULL;
+  vec->length = 0;
+  vec->capacity = 0;
+  vec->elem_size = elem_size;
+  vec->generation = arena->generation;
+}
+
+mem_vec_t *mem_vec_new(mem_arena_t *arena, size_t elem_size) {
+  if (arena == NULL || elem_size == 0) {
+    return NULL;
+  }
+  mem_vec_t *vec = mem_alloc(arena, sizeof(*vec));
+  if (vec) {
+    mem_vec_init(vec, arena, elem_size);
+  }
+  return vec;
+}
+
+/* resize the buffer to capacity elements, in place when it's the last
+ * allocation of its region (see mem_realloc) */
+static int _vec_resize(mem_vec_t *vec, size_t capacity) {
+  if (capacity > SIZE_MAX / 2 / vec->elem_size) {
+    return -1;
+  }
+  void *data = mem_realloc(vec->arena, vec->data, capacity * vec->elem_size);
+  if (data == NULL) {
+    return -1;
+  }
+  vec->data = data;
+  vec->capacity = capacity;
+  return 0;
+}
+
+int mem_vec_reserve(mem_vec_t *vec, size_t capacity) {
+  if (vec == NULL) {
+    return -1;
+  }
+  _mem_vec_sync(vec);
+  if (capacity <= vec->capacity) {
+    return 0;
+  }
+  /* geometric growth, unless more is asked */
+  size_t grown = vec->capacity < 8 ? 8 : vec->capacity * 2;
+  return _vec_resize(vec, capacity > grown ? capacity : grown);
+}
+
+void *mem_vec_append(mem_vec_t *vec, const void *elems, size_t count) {
+  if (vec == NULL || count == 0) {
+    return NULL;
+  }
+  _mem_vec_sync(vec);
+  if (count > SIZE_MAX - vec->length ||
+      mem_vec_reserve(vec, vec->length + count) != 0) {
+    return NULL;
+  }
+  uint8_t *dest = (uint8_t *)vec->data + vec->length * vec->elem_size;
+  if (elems) {
+    memcpy(dest, elems, count * vec->elem_size);
+  }
+  vec->length += count;
+  return dest;
+}
+
+void *mem_vec_push(mem_vec_t *vec, const void *elem) {
+  return mem_vec_append(vec, elem, 1);
+}
+
+int mem_vec_pop(mem_vec_t *vec, void *elem) {
+  if (vec == NULL) {
+    return -1;
+  }
+  _mem_vec_sync(vec);
+  if (vec->length == 0) {
+    return -1;
+  }
+  vec->length--;
+  if (elem) {
+    memcpy(elem, (uint8_t *)vec->data + vec->length * vec->elem_size,
+           vec->elem_size);
+  }
+  return 0;
+}
+
+void mem_vec_shrink(mem_vec_t *vec) {
+  if (vec == NULL) {
+    return;
+  }
+  _mem_vec_sync(vec);
+  if (vec->length == vec->capacity) {
+    return;
+  }
+  if (vec->length == 0) {
+    mem_free(vec->arena, vec->data);
+    vec->data = NULL;
+    vec->capacity = 0;
+    return;
+  }
+  _vec_resize(vec, vec->length);
+}
+
+void mem_vec_clear(mem_vec_t *vec) {
+  if (vec == NULL) {
+    return;
+  }
+  _mem_vec_sync(vec);
+  vec->length = 0;
+}
+
+/* *** String builder *** */
+
+void mem_str_init(mem_str_t *str, mem_arena_t *arena) {
+  mem_vec_init(&str->vec, arena, 1);
+}
+
+/* room for length more bytes and the NUL */
+static int _str_reserve(mem_str_t *str, size_t length) {
+  _mem_vec_sync(&str->vec);
+  if (length >= SIZE_MAX / 2 - str->vec.length) {
+    return -1;
+  }
+  return mem_vec_reserve(&str->vec, str->vec.length + length + 1);
+}
+
+int mem_str_append(mem_str_t *str, const void *bytes, size_t length) {
+  if (str == NULL || (bytes == NULL && length > 0) ||
+      _str_reserve(str, length) != 0) {
+    return -1;
+  }
+  char *end = (char *)str->vec.data + str->vec.length;
+  memcpy(end, bytes, length);
+  end[length] = '\0';
+  str->vec.length += length;
+  return 0;
+}
+
+int mem_str_appends(mem_str_t *str, const char *string) {
+  if (string == NULL) {
+    return -1;
+  }
+  return mem_str_append(str, string, strlen(string));
+}
+
+int mem_str_appendc(mem_str_t *str, char c) {
+  return mem_str_append(str, &c, 1);
+}
+
+int mem_str_vprintf(mem_str_t *str, const char *format, va_list args) {
+  if (str == NULL || format == NULL || _str_reserve(str, 0) != 0) {
+    return -1;
+  }
+  /* try in the room left, then again once grown to the exact size */
+  va_list copy;
+  va_copy(copy, args);
+  size_t room = str->vec.capacity - str->vec.length;
+  int length =
+      vsnprintf((char *)str->vec.data + str->vec.length, room, format, args);
+  if (length >= 0 && (size_t)length >= room) {
+    if (_str_reserve(str, length) != 0) {
+      length = -1;
+    } else {
+      vsnprintf((char *)str->vec.data + str->vec.length, length + 1, format,
+                copy);
+    }
+  }
+  va_end(copy);
+  if (length < 0) {
+    /* vsnprintf may have written, put the NUL back */
+    ((char *)str->vec.data)[str->vec.length] = '\0';
+    return -1;
+  }
+  str->vec.length += length;
+  return 0;
+}
+
+int mem_str_printf(mem_str_t *str, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int ret = mem_str_vprintf(str, format, args);
+  va_end(args);
+  return ret;
+}
+
+char *mem_str_finish(mem_str_t *str) {
+  if (str == NULL) {
+    return NULL;
+  }
+  _mem_vec_sync(&str->vec);
+  char *string = str->vec.data;
+  if (string) {
+    /* keep the NUL */
+    str->vec.length++;
+    mem_vec_shrink(&str->vec);
+    string = str->vec.data;
+  }
+  mem_vec_init(&str->vec, str->vec.arena, 1);
+  return string;
+}
+
+/* *** String interning *** */
+
+#define INTERN_MIN_CAPACITY 64
+
+/* murmur3 finalizer */
+static inline uint64_t _mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+/* word at a time, long keys cost two multiplies per 8 bytes, the final mix
+ * spreads everything */
+static uint32_t _hash_bytes(const char *bytes, size_t length) {
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+  uint64_t word = 0;
+  for (; length >= 8; bytes += 8, length -= 8) {
+    memcpy(&word, bytes, 8);
+    word *= 0x87c37b91114253d5ull;
+    h = (h ^ (word ^ (word >> 31))) * 0x9e3779b97f4a7c15ull;
+  }
+  /* tail of 0 to 7 bytes, with fixed size loads (overlapping for 4 to 7) */
+  word = 0;
+  if (length >= 4) {
+    uint32_t lo = 0, hi = 0;
+    memcpy(&lo, bytes, 4);
+    memcpy(&hi, bytes + length - 4, 4);
+    word = ((uint64_t)hi << 32) | lo;
+  } else if (length > 0) {
+    word = ((uint64_t)(uint8_t)bytes[0] << 16) |
+           ((uint64_t)(uint8_t)bytes[length / 2] << 8) |
+           (uint8_t)bytes[length - 1];
+  }
+  h = _mix64(h ^ word);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+void mem_intern_init(mem_intern_t *table, mem_arena_t *arena) {
+  assert(table != NULL && arena != NULL);
+  table->arena = arena;
+  table->buckets = NULL;
+  table->capacity = 0;
+  table->count = 0;
+  table->generation = arena->generation;
+  table->flags = 0;
+}
+
+int mem_intern_init_flags(mem_intern_t *table, mem_arena_t *arena,
+                          unsigned int flags) {
+  assert(table != NULL);
+  if (flags & MEM_INTERN_PERSISTENT) {
+    /* nobody else resets it */
+    arena = mem_arena_new(0);
+    if (arena == NULL) {
+      return -1;
+    }
+  }
+  mem_intern_init(table, arena);
+  table->flags = flags;
+  return 0;
+}
+
+void mem_intern_destroy(mem_intern_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  if (table->flags & MEM_INTERN_PERSISTENT) {
+    mem_arena_destroy(table->arena);
+  }
+  table->arena = NULL;
+  table->buckets = NULL;
+  table->capacity = 0;
+  table->count = 0;
+}
+
+/* forget buckets allocated before the last arena reset */
+static void _intern_sync(mem_intern_t *table) {
+  if (table->generation != table->arena->generation) {
+    table->buckets = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->generation = table->arena->generation;
+  }
+}
+
+/* bucket holding the string, or the empty one where it goes */
+static mem_intern_entry_t *_intern_find(mem_intern_t *table, const char *bytes,
+                                        uint32_t length, uint32_t hash) {
+  size_t mask = table->capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    mem_intern_entry_t *entry = &table->buckets[i];
+    if (entry->string == NULL ||
+        (entry->hash == hash && entry->length == length &&
+         memcmp(entry->string, bytes, length) == 0)) {
+      return entry;
+    }
+  }
+}
+
+/* double the buckets, old ones stay in the arena until reset */
+static int _intern_grow(mem_intern_t *table) {
+  size_t capacity =
+      table->capacity ? table->capacity * 2 : INTERN_MIN_CAPACITY;
+  if (capacity > SIZE_MAX / 2 / sizeof(mem_intern_entry_t)) {
+    return -1;
+  }
+  mem_intern_entry_t *buckets =
+      mem_alloc(table->arena, capacity * sizeof(*buckets));
+  if (buckets == NULL) {
+    return -1;
+  }
+  memset(buckets, 0, capacity * sizeof(*buckets));
+  mem_intern_entry_t *old = table->buckets;
+  size_t old_capacity = table->capacity;
+  table->buckets = buckets;
+  table->capacity = capacity;
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old[i].string) {
+      size_t j = old[i].hash & (capacity - 1);
+      while (buckets[j].string) {
+        j = (j + 1) & (capacity - 1);
+      }
+      buckets[j] = old[i];
+    }
+  }
+  mem_free(table->arena, old);
+  return 0;
+}
+
+const char *mem_intern_lookup(mem_intern_t *table, const char *bytes,
+                              size_t length) {
+  if (table == NULL || bytes == NULL || length > UINT32_MAX) {
+    return NULL;
+  }
+  _intern_sync(table);
+  if (table->count == 0) {
+    return NULL;
+  }
+  return _intern_find(table, bytes, length, _hash_bytes(bytes, length))
+      ->string;
+}
+
+const char *mem_intern_n(mem_intern_t *table, const char *bytes,
+                         size_t length) {
+  if (table == NULL || bytes == NULL || length > UINT32_MAX) {
+    return NULL;
+  }
+  _intern_sync(table);
+  /* at most 3/4 full so probing stays short */
+  if (table->count + 1 > table->capacity - table->capacity / 4 &&
+      _intern_grow(table) != 0) {
+    return NULL;
+  }
+  uint32_t hash = _hash_bytes(bytes, length);
+  mem_intern_entry_t *entry = _intern_find(table, bytes, length, hash);
+  if (entry->string) {
+    return entry->string;
+  }
+  char *string = mem_alloc_nohdr(table->arena, length + 1);
+  if (string == NULL) {
+    return NULL;
+  }
+  memcpy(string, bytes, length);
+  string[length] = '\0';
+  entry->string = string;
+  entry->hash = hash;
+  entry->length = (uint32_t)length;
+  table->count++;
+  return string;
+}
+
+const char *mem_intern(mem_intern_t *table, const char *string) {
+  if (string == NULL) {
+    return NULL;
+  }
+  return mem_intern_n(table, string, strlen(string));
+}
+
+size_t mem_intern_count(mem_intern_t *table) {
+  if (table == NULL) {
+    return 0;
+  }
+  _intern_sync(table);
+  return table->count;
+}
+
+/* *** Object pool *** */
+
+#define POOL_CACHES 8
+/* objects moved at once between a thread cache and its pool */
+#define POOL_BATCH 32
+
+/* evicted thread caches waiting for their pool */
+#define POOL_DEPOT 64
+
+/* a list of up to POOL_BATCH objects and a full one, tails are kept so a
+ * batch moves to the pool without walking it */
+typedef struct {
+  size_t id; /* 0 for an unused slot */
+  size_t generation;
+  size_t used; /* last use, the least recent slot is taken over */
+  void *list;
+  void *tail;
+  size_t count;
+  void *spare;
+  void *spare_tail;
+} _pool_cache_t;
+
+static _Thread_local _pool_cache_t _pool_caches[POOL_CACHES];
+static _Thread_local size_t _pool_clock;
+static size_t _pool_ids = 0;
+
+/* Lists of evicted thread caches, by pool id and arena generation. Neither
+ * the pool nor its arena are touched when a cache is evicted, another thread
+ * may have destroyed them meanwhile: the pool takes its lists back itself,
+ * under its lock, before cutting a new slab. Lists of a reset arena or of a
+ * pool never coming back are dropped, the oldest first once the depot is
+ * full. */
+static _pool_cache_t _pool_depot[POOL_DEPOT];
+static size_t _pool_depot_next = 0;
+static size_t _pool_depot_count = 0;
+static pthread_mutex_t _pool_depot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void mem_pool_init(mem_pool_t *pool, mem_arena_t *arena, size_t size,
+                   size_t align, unsigned int flags) {
+  assert(pool != NULL && arena != NULL && size > 0 && size <= SIZE_MAX / 4);
+  assert((align & (align - 1)) == 0);
+  if (align < alignof(void *)) {
+    align = align ? alignof(void *) : MEMARENA_ALIGNMENT;
+  }
+  if (size < sizeof(void *)) {
+    size = sizeof(void *);
+  }
+  pool->arena = arena;
+  pool->free = NULL;
+  pool->slab = NULL;
+  pool->slab_end = NULL;
+  pool->object_size = ROUND_UP_POW2(size, align);
+  pool->align = align;
+  pool->generation = arena->generation;
+  pool->id = __atomic_add_fetch(&_pool_ids, 1, __ATOMIC_RELAXED);
+  pool->flags = flags;
+  pool->lock = 0;
+}
+
+mem_pool_t *mem_pool_new(mem_arena_t *arena, size_t size, size_t align,
+                         unsigned int flags) {
+  if (arena == NULL || size == 0 || size > SIZE_MAX / 4 ||
+      (align & (align - 1)) != 0) {
+    return NULL;
+  }
+  mem_pool_t *pool = mem_alloc(arena, sizeof(*pool));
+  if (pool) {
+    mem_pool_init(pool, arena, size, align, flags);
+  }
+  return pool;
+}
+
+static void _pool_lock(mem_pool_t *pool) {
+  while (__atomic_exchange_n(&pool->lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&pool->lock, __ATOMIC_RELAXED)) {
+      sched_yield();
+    }
+  }
+}
+
+static void _pool_unlock(mem_pool_t *pool) {
+  __atomic_store_n(&pool->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* park the lists of an evicted slot in the depot */
+static void _pool_depot_put(_pool_cache_t *cache) {
+  if (cache->list == NULL && cache->spare == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&_pool_depot_lock);
+  _pool_cache_t *entry = &_pool_depot[_pool_depot_next];
+  _pool_depot_next = (_pool_depot_next + 1) % POOL_DEPOT;
+  if (entry->id == 0) {
+    __atomic_store_n(&_pool_depot_count, _pool_depot_count + 1,
+                     __ATOMIC_RELAXED);
+  }
+  *entry = *cache;
+  pthread_mutex_unlock(&_pool_depot_lock);
+}
+
+/* move the depot lists of the pool to its free list, pool locked if shared.
+ * Returns 0 if there was none */
+static int _pool_depot_take(mem_pool_t *pool) {
+  if (__atomic_load_n(&_pool_depot_count, __ATOMIC_RELAXED) == 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&_pool_depot_lock);
+  for (int i = 0; i < POOL_DEPOT; i++) {
+    _pool_cache_t *entry = &_pool_depot[i];
+    if (entry->id != pool->id) {
+      continue;
+    }
+    /* still the arena they were cut from, the objects are valid */
+    if (entry->generation == pool->generation) {
+      if (entry->spare) {
+        FREELIST_NEXT(entry->spare_tail) = pool->free;
+        pool->free = entry->spare;
+      }
+      if (entry->list) {
+        FREELIST_NEXT(entry->tail) = pool->free;
+        pool->free = entry->list;
+      }
+    }
+    entry->id = 0;
+    __atomic_store_n(&_pool_depot_count, _pool_depot_count - 1,
+                     __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&_pool_depot_lock);
+  return pool->free != NULL;
+}
+
+/* an object from the free list or the slab, pool locked if shared */
+static void *_pool_take(mem_pool_t *pool) {
+  if (pool->generation != pool->arena->generation) {
+    /* slabs were released by a reset */
+    pool->free = NULL;
+    pool->slab = pool->slab_end = NULL;
+    pool->generation = pool->arena->generation;
+  }
+  void *ptr = pool->free;
+  if (ptr) {
+    pool->free = FREELIST_NEXT(ptr);
+    return ptr;
+  }
+  if (pool->slab == pool->slab_end && _pool_depot_take(pool)) {
+    ptr = pool->free;
+    pool->free = FREELIST_NEXT(ptr);
+    return ptr;
+  }
+  if (pool->slab == pool->slab_end) {
+    size_t count = MEMARENA_POOL_SLAB / pool->object_size;
+    if (count == 0) {
+      count = 1;
+    }
+    uint8_t *slab =
+        mem_alloc_aligned(pool->arena, count * pool->object_size, pool->align);
+    if (slab == NULL) {
+      return NULL;
+    }
+    pool->slab = slab;
+    pool->slab_end = slab + count * pool->object_size;
+  }
+  ptr = pool->slab;
+  pool->slab += pool->object_size;
+  return ptr;
+}
+
+/* this thread cache of the pool. Its home slot is tried first, then any
+ * other, and when none has it the least recently used slot is taken over */
+static _pool_cache_t *_pool_cache(mem_pool_t *pool) {
+  _pool_cache_t *cache = &_pool_caches[pool->id % POOL_CACHES];
+  if (cache->id != pool->id) {
+    _pool_cache_t *lru = cache;
+    cache = NULL;
+    for (int i = 0; i < POOL_CACHES && cache == NULL; i++) {
+      if (_pool_caches[i].id == pool->id) {
+        cache = &_pool_caches[i];
+      } else if (_pool_caches[i].used < lru->used) {
+        lru = &_pool_caches[i];
+      }
+    }
+    if (cache == NULL) {
+      _pool_depot_put(lru);
+      cache = lru;
+      cache->id = pool->id;
+      cache->generation = pool->arena->generation;
+      cache->list = NULL;
+      cache->count = 0;
+      cache->spare = NULL;
+    }
+  }
+  if (cache->generation != pool->arena->generation) {
+    /* arena was reset, the objects are gone with it */
+    cache->generation = pool->arena->generation;
+    cache->list = NULL;
+    cache->count = 0;
+    cache->spare = NULL;
+  }
+  cache->used = ++_pool_clock;
+  return cache;
+}
+
+void *mem_pool_alloc(mem_pool_t *pool) {
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (!(pool->flags & MEM_POOL_THREAD_CACHE)) {
+    return _pool_take(pool);
+  }
+
+  _pool_cache_t *cache = _pool_cache(pool);
+  if (cache->list == NULL && cache->spare) {
+    cache->list = cache->spare;
+    cache->tail = cache->spare_tail;
+    cache->count = POOL_BATCH;
+    cache->spare = NULL;
+  } else if (cache->list == NULL) {
+    _pool_lock(pool);
+    for (size_t i = 0; i < POOL_BATCH; i++) {
+      void *ptr = _pool_take(pool);
+      if (ptr == NULL) {
+        break;
+      }
+      if (cache->list == NULL) {
+        cache->tail = ptr;
+      }
+      FREELIST_NEXT(ptr) = cache->list;
+      cache->list = ptr;
+      cache->count++;
+    }
+    _pool_unlock(pool);
+    if (cache->list == NULL) {
+      return NULL;
+    }
+  }
+  void *ptr = cache->list;
+  cache->list = FREELIST_NEXT(ptr);
+  cache->count--;
+  return ptr;
+}
+
+void mem_pool_free(mem_pool_t *pool, void *ptr) {
+  if (pool == NULL || ptr == NULL) {
+    return;
+  }
+  if (!(pool->flags & MEM_POOL_THREAD_CACHE)) {
+    FREELIST_NEXT(ptr) = pool->free;
+    pool->free = ptr;
+    return;
+  }
+
+  _pool_cache_t *cache = _pool_cache(pool);
+  if (cache->count == POOL_BATCH) {
+    if (cache->spare) {
+      /* give a batch back so other threads can use it */
+      _pool_lock(pool);
+      FREELIST_NEXT(cache->spare_tail) = pool->free;
+      pool->free = cache->spare;
+      _pool_unlock(pool);
+    }
+    cache->spare = cache->list;
+    cache->spare_tail = cache->tail;
+    cache->list = NULL;
+    cache->count = 0;
+  }
+  if (cache->list == NULL) {
+    cache->tail = ptr;
+  }
+  FREELIST_NEXT(ptr) = cache->list;
+  cache->list = ptr;
+  cache->count++;
+}
+
+/* *** Scratch arena *** */
+
+typedef struct {
+  mem_arena_t *arena[MEMARENA_SCRATCH_COUNT];
+  int depth[MEMARENA_SCRATCH_COUNT];
+  /* where each nested scope started */
+  mem_arena_mark_t marks[MEMARENA_SCRATCH_COUNT][MEMARENA_SCRATCH_DEPTH];
+} _scratch_t;
+
+static _Thread_local _scratch_t _scratch;
+static pthread_key_t _scratch_key;
+static pthread_once_t _scratch_once = PTHREAD_ONCE_INIT;
+
+/* thread exit, give scratch arenas back to the system */
+static void _scratch_destroy(void *ptr) {
+  _scratch_t *scratch = ptr;
+  for (int i = 0; i < MEMARENA_SCRATCH_COUNT; i++) {
+    mem_arena_destroy(scratch->arena[i]);
+    scratch->arena[i] = NULL;
+    scratch->depth[i] = 0;
+  }
+}
+
+static void _scratch_key_init(void) {
+  pthread_key_create(&_scratch_key, _scratch_destroy);
+}
+
+mem_arena_t *mem_scratch_begin(mem_arena_t *conflict) {
+  for (int i = 0; i < MEMARENA_SCRATCH_COUNT; i++) {
+    if (_scratch.arena[i] != NULL && _scratch.arena[i] == conflict) {
+      continue;
+    }
+    if (_scratch.arena[i] == NULL) {
+      pthread_once(&_scratch_once, _scratch_key_init);
+      _scratch.arena[i] = mem_arena_new(MEMARENA_SCRATCH_SIZE);
+      if (_scratch.arena[i] == NULL) {
+        return NULL;
+      }
+      pthread_setspecific(_scratch_key, &_scratch);
+    }
+    /* deeper than we keep track of, these scopes end with their parent */
+    if (_scratch.depth[i] < MEMARENA_SCRATCH_DEPTH) {
+      _scratch.marks[i][_scratch.depth[i]] = mem_arena_mark(_scratch.arena[i]);
+    }
+    _scratch.depth[i]++;
+    return _scratch.arena[i];
+  }
+  return NULL;
+}
+
+void mem_scratch_end(mem_arena_t *scratch) {
+  for (int i = 0; i < MEMARENA_SCRATCH_COUNT; i++) {
+    if (_scratch.arena[i] == scratch && _scratch.depth[i] > 0) {
+      int depth = --_scratch.depth[i];
+      if (depth == 0) {
+        mem_arena_reset(scratch);
+      } else if (depth < MEMARENA_SCRATCH_DEPTH) {
+        mem_arena_rewind(scratch, _scratch.marks[i][depth]);
+      }
+      return;
+    }
+  }
+}
+
+/* *** String function *** */
+
+char *mem_strndup(mem_arena_t *arena, const char *string, size_t length) {
+  if (arena == NULL || string == NULL || length == 0) {
+    return NULL;
+  }
+
+  /* Nothing is read past length. When the bound fits in the tail region,
+   * scan and copy are one memccpy into a block of the bound, the unused end
+   * is given back right away when it's the last allocation of its region (a
+   * block taken from the free lists is not). Otherwise the length is found
+   * first so no more than needed is allocated. */
+  if (!(arena->flags & MEM_ARENA_CONCURRENT) && length < SIZE_MAX / 2 &&
+      REGION_FREE_SPACE(arena->tail) >=
+          ALIGNED_SIZE(length + 1) + HEADER_SIZE) {
+    char *new_str = mem_alloc(arena, length + 1);
+    if (new_str == NULL) {
+      return NULL;
+    }
+    char *end = memccpy(new_str, string, '\0', length);
+    mem_arena_block_t *block = GET_BLOCK_FROM_PTR(new_str);
+    mem_arena_region_t *region = block->region;
+    if (end == NULL) {
+      new_str[length] = '\0';
+    } else if (region->last_alloc == (uint8_t *)new_str) {
+      /* cut it to the string. Nothing was written past it, the dirty mark
+       * stays */
+      size_t used = (size_t)(end - (char *)region->data);
+      STAT_USED(arena, region->used, ALIGNED_SIZE(used));
+      region->used = ALIGNED_SIZE(used);
+      block->size = (size_t)(end - new_str);
+    }
+    return new_str;
+  }
+
+  length = strnlen(string, length);
   char *new_str = mem_alloc(arena, length + 1);
   if (new_str) {
     memcpy(new_str, string, length);
@@ -307,6 +2265,54 @@ char *mem_strndup(mem_arena_t *arena, const char *string, size_t length) {
   return new_str;
 }
 
+/* Duplicate count strings in one block, bounded by lengths if not NULL. out
+ * keeps the lengths between the two passes. */
+static char *_dup_batch(mem_arena_t *arena, const char *const *strings,
+                        const size_t *lengths, size_t count, char **out) {
+  if (arena == NULL || strings == NULL || out == NULL || count == 0) {
+    return NULL;
+  }
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (strings[i] == NULL) {
+      return NULL;
+    }
+    size_t length =
+        lengths ? strnlen(strings[i], lengths[i]) : strlen(strings[i]);
+    if (length >= SIZE_MAX / 2 - total) {
+      return NULL;
+    }
+    total += length + 1;
+    out[i] = (char *)(uintptr_t)length;
+  }
+  char *block = mem_alloc(arena, total);
+  if (block == NULL) {
+    return NULL;
+  }
+  char *dest = block;
+  for (size_t i = 0; i < count; i++) {
+    size_t length = (size_t)(uintptr_t)out[i];
+    memcpy(dest, strings[i], length);
+    dest[length] = '\0';
+    out[i] = dest;
+    dest += length + 1;
+  }
+  return block;
+}
+
+char *mem_strdup_batch(mem_arena_t *arena, const char *const *strings,
+                       size_t count, char **out) {
+  return _dup_batch(arena, strings, NULL, count, out);
+}
+
+char *mem_strndup_batch(mem_arena_t *arena, const char *const *strings,
+                        const size_t *lengths, size_t count, char **out) {
+  if (lengths == NULL) {
+    return NULL;
+  }
+  return _dup_batch(arena, strings, lengths, count, out);
+}
+
 char *mem_strdup(mem_arena_t *arena, const char *string) {
   if (arena == NULL || string == NULL) {
     return NULL;
@@ -337,5 +2343,5 @@ size_t mem_memsize(mem_arena_t *arena, const void *ptr) {
   if (ptr == NULL || arena == NULL) {
     return 0;
   }
-  return *GET_SIZE_T_PTR_FROM_PTR(ptr);
+  return GET_BLOCK_FROM_PTR(ptr)->size;
 }
@@ -1,18 +1,31 @@
 
 #include "../src/include/memarena.h"
-#include <bits/time.h>
 #include <check.h>
 #include <iso646.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #define ALIGNED_SIZE(x)                                                        \
   ((((x) + (MEMARENA_ALIGNMENT - 1)) / MEMARENA_ALIGNMENT) * MEMARENA_ALIGNMENT)
 #define REGION_FREE_SPACE(r) ((r)->capacity - (r)->used)
+#define GET_REGION(ptr)                                                        \
+  (((mem_arena_block_t *)((uint8_t *)(ptr) -                                   \
+                          ALIGNED_SIZE(sizeof(mem_arena_block_t))))            \
+       ->region)
+
+static int count_regions(mem_arena_t *arena) {
+  int cnt = 0;
+  for (mem_arena_region_t *r = arena->head; r; r = r->next) {
+    cnt++;
+  }
+  return cnt;
+}
 
 START_TEST(test_memarena_init) {
   int ps = getpagesize();
@@ -40,6 +53,47 @@ START_TEST(test_memarena_malloc) {
 }
 END_TEST
 
+START_TEST(test_memarena_malloc_nohdr) {
+  mem_arena_t *arena = mem_arena_new(0);
+
+  uint8_t *p1 = mem_alloc_nohdr(arena, 8);
+  uint8_t *p2 = mem_alloc_nohdr(arena, 8);
+  uint8_t *p3 = mem_alloc_nohdr(arena, 24);
+  uint8_t *p4 = mem_alloc_nohdr(arena, 1);
+  uint8_t *p5 = mem_alloc_nohdr(arena, 32);
+  /* packed, no header between them */
+  ck_assert_ptr_eq(p2, p1 + 8);
+  ck_assert_ptr_eq(p3, p2 + 8);
+  ck_assert_ptr_eq(p4, p3 + 24);
+  size_t p5_align = MEMARENA_ALIGNMENT < 32 ? MEMARENA_ALIGNMENT : 32;
+  ck_assert_int_eq((uintptr_t)p5 % p5_align, 0);
+
+  /* mixed with regular allocation, header stay aligned */
+  uint8_t *p6 = mem_alloc(arena, 12);
+  ck_assert_int_eq((uintptr_t)p6 % MEMARENA_ALIGNMENT, 0);
+  ck_assert_int_eq(mem_memsize(arena, p6), 12);
+
+  /* a regular allocation followed by a headerless one can't grow in place */
+  uint8_t *p7 = mem_alloc_nohdr(arena, 16);
+  uint8_t *p8 = mem_realloc(arena, p6, 64);
+  ck_assert_ptr_ne(p8, p6);
+  ck_assert_ptr_ne(p8, p7);
+
+  /* freeing every regular allocation keeps the region alive */
+  mem_arena_region_t *region = arena->tail;
+  mem_free(arena, p6);
+  mem_free(arena, p8);
+  ck_assert_int_gt(region->alloc_cnt, 0);
+
+  /* fill until a new region is needed */
+  mem_arena_region_t *tail = arena->tail;
+  while (arena->tail == tail) {
+    ck_assert_ptr_nonnull(mem_alloc_nohdr(arena, 16));
+  }
+  mem_arena_destroy(arena);
+}
+END_TEST
+
 START_TEST(test_memarena_realloc) {
   int ps = getpagesize();
   size_t asize = ALIGNED_SIZE(sizeof(size_t));
@@ -86,6 +140,71 @@ START_TEST(test_memarena_realloc) {
 }
 END_TEST
 
+START_TEST(test_memarena_realloc_remap) {
+  const size_t step = getpagesize() * 16;
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  /* some region before and after, so remapping must keep the chain */
+  ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() * 2));
+  uint8_t *ptr = mem_alloc(arena, step);
+  ck_assert_ptr_nonnull(ptr);
+  memset(ptr, 1, step);
+  uint8_t *other = mem_alloc(arena, getpagesize() * 2);
+  ck_assert_ptr_nonnull(other);
+  memset(other, 2, getpagesize() * 2);
+  int regions = count_regions(arena);
+
+  for (int i = 2; i < 64; i++) {
+    ptr = mem_realloc(arena, ptr, i * step);
+    ck_assert_ptr_nonnull(ptr);
+    ck_assert_int_eq(mem_memsize(arena, ptr), i * step);
+    ck_assert_int_eq(ptr[0], 1);
+    ck_assert_int_eq(ptr[(i - 1) * step - 1], i - 1);
+    memset(ptr + (i - 1) * step, i, step);
+  }
+  /* region grew, no other one was needed */
+  ck_assert_int_eq(count_regions(arena), regions);
+  ck_assert_int_eq(other[0], 2);
+  mem_arena_region_t *prev = NULL;
+  for (mem_arena_region_t *r = arena->head; r; r = r->next) {
+    ck_assert_ptr_eq(r->prev, prev);
+    prev = r;
+  }
+  ck_assert_ptr_eq(arena->last, prev);
+
+  /* block still belongs to its region, which gets recycled */
+  mem_free(arena, ptr);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 63 * step));
+  ck_assert_int_eq(count_regions(arena), regions);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_realloc_remap_arena_region) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  uint8_t *small = mem_alloc(arena, 100);
+  ck_assert_ptr_nonnull(small);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 64 * 1024));
+  /* emptied, the region holding the arena goes after the tail */
+  mem_free(arena, small);
+  mem_arena_region_t *holder = arena->last;
+  ck_assert_ptr_ne(holder, arena->head);
+  /* fill the tail until a block is the first of the holding region */
+  uint8_t *ptr;
+  do {
+    ptr = mem_alloc(arena, 1000);
+    ck_assert_ptr_nonnull(ptr);
+  } while (holder->alloc_cnt == 0);
+  memset(ptr, 3, 1000);
+
+  ptr = mem_realloc(arena, ptr, 64 * 1024 * 1024);
+  ck_assert_ptr_nonnull(ptr);
+  ck_assert_int_eq(ptr[999], 3);
+  memset(ptr, 4, 64 * 1024 * 1024);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 100));
+  mem_arena_destroy(arena);
+}
+END_TEST
+
 START_TEST(test_memarena_memdup) {
   char ptr[100] = {0};
 
@@ -190,6 +309,1352 @@ START_TEST(test_memarena_free_reuse_bug_region1) {
 }
 END_TEST
 
+START_TEST(test_memarena_free_many_regions) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  void *first[32] = {0};
+  int n = 0;
+  /* keep the allocations of the first region */
+  while (arena->tail == arena->head) {
+    first[n++] = mem_alloc(arena, getpagesize() / 8);
+    ck_assert_ptr_nonnull(first[n - 1]);
+  }
+  mem_arena_region_t *p0 = arena->head;
+  /* last one went into the second region */
+  n--;
+
+  /* build a long chain of region */
+  void *ptr = NULL;
+  for (int i = 0; i < 2000; i++) {
+    ptr = mem_alloc(arena, getpagesize() / 2);
+    ck_assert_ptr_nonnull(ptr);
+  }
+
+  /* owner is found from the pointer, so freeing the head region works and
+   * keeps the chain valid */
+  for (int i = 0; i < n; i++) {
+    mem_free(arena, first[i]);
+  }
+  ck_assert_int_eq(p0->alloc_cnt, 0);
+  ck_assert_ptr_eq(arena->last, p0);
+  ck_assert_ptr_nonnull(arena->head);
+  ck_assert_ptr_ne(arena->head, p0);
+
+  /* last allocation of the tail can still grow in place */
+  void *ptr2 = mem_realloc(arena, ptr, getpagesize() / 2 + 16);
+  ck_assert_ptr_eq(ptr, ptr2);
+  ck_assert_int_eq(mem_memsize(arena, ptr2), getpagesize() / 2 + 16);
+
+  int cnt = 0;
+  for (mem_arena_region_t *r = arena->head; r; r = r->next) {
+    if (r->next) {
+      ck_assert_ptr_eq(((mem_arena_region_t *)r->next)->prev, r);
+    }
+    cnt++;
+  }
+  ck_assert_int_gt(cnt, 500);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_spare_bins) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  for (int i = 0; i < 1000; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() / 2));
+  }
+  int total = count_regions(arena);
+  mem_arena_reset(arena);
+
+  /* every region but the head is waiting in a bin */
+  int binned = 0;
+  for (mem_arena_region_t *r = arena->head; r; r = r->next) {
+    if (r->bin >= 0) {
+      binned++;
+    }
+  }
+  ck_assert_int_eq(binned, total - 1);
+  ck_assert_uint_ne(arena->bin_mask, 0);
+
+  /* too big for any spare, a new region goes right after tail */
+  mem_arena_region_t *head = arena->head;
+  void *big = mem_alloc(arena, getpagesize() * 4);
+  ck_assert_ptr_nonnull(big);
+  ck_assert_int_eq(count_regions(arena), total + 1);
+  ck_assert_ptr_eq(head->next, arena->tail);
+
+  /* fits a spare, no new region */
+  mem_arena_region_t *tail = arena->tail;
+  void *ptr[16] = {0};
+  int n = 0;
+  while (arena->tail == tail) {
+    ptr[n] = mem_alloc(arena, getpagesize() / 2);
+    ck_assert_ptr_nonnull(ptr[n++]);
+  }
+  ck_assert_int_eq(count_regions(arena), total + 1);
+  ck_assert_int_eq(arena->tail->bin, -1);
+  ck_assert_ptr_eq(tail->next, arena->tail);
+
+  /* emptied region is binned again */
+  mem_free(arena, big);
+  for (int i = 0; i < n - 1; i++) {
+    mem_free(arena, ptr[i]);
+  }
+  ck_assert_ptr_eq(arena->last, tail);
+  ck_assert_int_ge(tail->bin, 0);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+#define CONCURRENT_THREADS 8
+#define CONCURRENT_ALLOCS 4000
+
+struct concurrent_job {
+  mem_arena_t *arena;
+  int id;
+  uint8_t *ptr[CONCURRENT_ALLOCS];
+};
+
+static void *concurrent_worker(void *arg) {
+  struct concurrent_job *job = arg;
+  for (int i = 0; i < CONCURRENT_ALLOCS; i++) {
+    /* once in a while, bigger than a region */
+    size_t size = i % 500 == 0 ? getpagesize() * 3 : (size_t)(i % 64) + 1;
+    job->ptr[i] = mem_alloc(job->arena, size);
+    if (job->ptr[i]) {
+      memset(job->ptr[i], job->id, size);
+    }
+  }
+  return NULL;
+}
+
+START_TEST(test_memarena_concurrent) {
+  mem_arena_t *arena = mem_arena_new_flags(getpagesize(), MEM_ARENA_CONCURRENT);
+  ck_assert_ptr_nonnull(arena);
+  static struct concurrent_job jobs[CONCURRENT_THREADS];
+  pthread_t threads[CONCURRENT_THREADS];
+
+  for (int round = 0; round < 2; round++) {
+    for (int t = 0; t < CONCURRENT_THREADS; t++) {
+      jobs[t].arena = arena;
+      jobs[t].id = t + 1;
+      pthread_create(&threads[t], NULL, concurrent_worker, &jobs[t]);
+    }
+    for (int t = 0; t < CONCURRENT_THREADS; t++) {
+      pthread_join(threads[t], NULL);
+    }
+
+    /* no block got overwritten by another thread */
+    for (int t = 0; t < CONCURRENT_THREADS; t++) {
+      for (int i = 0; i < CONCURRENT_ALLOCS; i++) {
+        uint8_t *ptr = jobs[t].ptr[i];
+        ck_assert_ptr_nonnull(ptr);
+        ck_assert_int_eq((uintptr_t)ptr % MEMARENA_ALIGNMENT, 0);
+        size_t size = mem_memsize(arena, ptr);
+        ck_assert_int_eq(size, i % 500 == 0 ? getpagesize() * 3
+                                            : (size_t)(i % 64) + 1);
+        ck_assert_int_eq(ptr[0], t + 1);
+        ck_assert_int_eq(ptr[size - 1], t + 1);
+      }
+    }
+
+    /* free is a no op */
+    mem_free(arena, jobs[0].ptr[0]);
+    ck_assert_int_eq(jobs[0].ptr[0][0], 1);
+    mem_arena_reset(arena);
+    ck_assert_ptr_eq(arena->tail, arena->head);
+  }
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+static void *scratch_worker(void *arg) {
+  mem_arena_t **scratch = arg;
+  *scratch = mem_scratch_begin(NULL);
+  mem_scratch_end(*scratch);
+  return NULL;
+}
+
+START_TEST(test_memarena_scratch) {
+  mem_arena_t *a = mem_scratch_begin(NULL);
+  ck_assert_ptr_nonnull(a);
+  char *str = mem_strdup(a, "caller result");
+
+  /* callee gets another arena than the one it has to fill */
+  mem_arena_t *b = mem_scratch_begin(a);
+  ck_assert_ptr_nonnull(b);
+  ck_assert_ptr_ne(a, b);
+  ck_assert_ptr_nonnull(mem_alloc(b, 128));
+
+  /* nested scope on a, memory is kept until the outermost end */
+  mem_arena_t *c = mem_scratch_begin(b);
+  ck_assert_ptr_eq(c, a);
+  mem_scratch_end(c);
+  ck_assert_str_eq(str, "caller result");
+  ck_assert_int_ne(a->head->used, 0);
+
+  mem_scratch_end(b);
+  ck_assert_int_eq(b->head->used, 0);
+  mem_scratch_end(a);
+  ck_assert_int_eq(a->head->used, 0);
+
+  /* same arena next time, it was reset not destroyed */
+  ck_assert_ptr_eq(mem_scratch_begin(NULL), a);
+  mem_scratch_end(a);
+
+  /* other thread has its own */
+  pthread_t thread;
+  mem_arena_t *other = NULL;
+  pthread_create(&thread, NULL, scratch_worker, &other);
+  pthread_join(thread, NULL);
+  ck_assert_ptr_nonnull(other);
+  ck_assert_ptr_ne(other, a);
+  ck_assert_ptr_ne(other, b);
+}
+END_TEST
+
+START_TEST(test_memarena_region_cache) {
+  mem_region_cache_stats_t before = {0}, stats = {0};
+  mem_region_cache_set_limit(64 * 1024 * 1024);
+  mem_region_cache_stats(&before);
+
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  for (int i = 0; i < 64; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize()));
+  }
+  mem_arena_destroy(arena);
+  mem_region_cache_stats(&stats);
+  ck_assert_uint_gt(stats.regions, before.regions);
+  ck_assert_uint_gt(stats.bytes, before.bytes);
+  ck_assert_uint_eq(stats.limit, 64 * 1024 * 1024);
+
+  /* same layout again, served from the cache */
+  size_t cached = stats.regions;
+  arena = mem_arena_new(getpagesize());
+  for (int i = 0; i < 64; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize()));
+  }
+  mem_region_cache_stats(&before);
+  ck_assert_uint_ge(before.hits, stats.hits + cached);
+  ck_assert_uint_eq(before.regions, 0);
+  mem_arena_destroy(arena);
+
+  /* above the limit it goes back to the system */
+  mem_region_cache_set_limit(getpagesize() * 4);
+  mem_region_cache_stats(&stats);
+  ck_assert_uint_le(stats.bytes, getpagesize() * 4);
+  mem_region_cache_trim(0);
+  mem_region_cache_stats(&stats);
+  ck_assert_uint_eq(stats.bytes, 0);
+  ck_assert_uint_eq(stats.regions, 0);
+  mem_region_cache_set_limit(0);
+}
+END_TEST
+
+START_TEST(test_memarena_hugepage) {
+  const size_t huge = MEMARENA_HUGEPAGE_SIZE;
+  mem_arena_t *arena = mem_arena_new_flags(0, MEM_ARENA_HUGEPAGE);
+  ck_assert_ptr_nonnull(arena);
+  ck_assert_int_eq(arena->pagesize, huge);
+
+  /* regions are whole huge pages, aligned on them */
+  uint8_t *ptr = mem_alloc(arena, huge);
+  ck_assert_ptr_nonnull(ptr);
+  memset(ptr, 1, huge);
+  for (mem_arena_region_t *r = arena->head; r; r = r->next) {
+    size_t mapped = (size_t)(r->data - (uint8_t *)r) + r->capacity;
+    ck_assert_int_eq(mapped % huge, 0);
+    ck_assert_int_eq((uintptr_t)r % huge, 0);
+    ck_assert_int_ne(r->flags, 0);
+  }
+  ck_assert_int_eq(mem_memsize(arena, ptr), huge);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_reset_trim) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  for (int i = 0; i < 100; i++) {
+    uint8_t *ptr = mem_alloc(arena, getpagesize());
+    ck_assert_ptr_nonnull(ptr);
+    memset(ptr, 0xaa, getpagesize());
+  }
+  int total = count_regions(arena);
+  mem_arena_region_t *r1 = arena->head->next;
+
+  /* default policy, pages above the retained size are given back and read
+   * as zero, regions stay */
+  mem_arena_set_trim(arena, 0, 0);
+  for (int i = 0; i < 64; i++) {
+    mem_arena_reset_trim(arena);
+  }
+  ck_assert_int_eq(arena->high_water, 0);
+  ck_assert_int_eq(count_regions(arena), total);
+  ck_assert_int_eq(r1->data[getpagesize()], 0);
+
+  /* unmap surplus, high water mark decays over resets */
+  for (int i = 0; i < 100; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize()));
+  }
+  mem_arena_set_trim(arena, getpagesize() * 8, MEM_TRIM_UNMAP);
+  /* kept size covers what was used, regions were half full */
+  mem_arena_reset_trim(arena);
+  ck_assert_int_le(count_regions(arena), total);
+  ck_assert_int_ge(count_regions(arena), total / 2);
+  int previous = count_regions(arena);
+  for (int i = 0; i < 64; i++) {
+    mem_arena_reset_trim(arena);
+    ck_assert_int_le(count_regions(arena), previous);
+    previous = count_regions(arena);
+  }
+  ck_assert_int_lt(count_regions(arena), 10);
+  ck_assert_int_gt(count_regions(arena), 1);
+
+  /* still usable */
+  for (int i = 0; i < 100; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize()));
+  }
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_reset_trim_arena_region) {
+  /* the region holding the arena is recycled to the end of the chain, it
+   * isn't head anymore but must not be unmapped */
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  void *small = mem_alloc(arena, 100);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 64 * 1024));
+  mem_free(arena, small);
+  mem_arena_set_trim(arena, 0, MEM_TRIM_UNMAP);
+  mem_arena_reset_trim(arena);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 100));
+  mem_arena_destroy(arena);
+
+  /* same for a child, its struct must not go back to the parent */
+  mem_arena_t *parent = mem_arena_new(256 * 1024);
+  mem_arena_t *child = mem_arena_new_child(parent, getpagesize());
+  small = mem_alloc(child, 100);
+  ck_assert_ptr_nonnull(mem_alloc(child, 64 * 1024));
+  mem_free(child, small);
+  mem_arena_set_trim(child, 0, MEM_TRIM_UNMAP);
+  mem_arena_reset_trim(child);
+  memset(mem_alloc(parent, 4096), 0xff, 4096);
+  ck_assert_ptr_eq(child->parent, parent);
+  ck_assert_ptr_nonnull(mem_alloc(child, 100));
+  mem_arena_destroy(child);
+  mem_arena_destroy(parent);
+}
+END_TEST
+
+static size_t fixed_growth(const mem_arena_t *arena, size_t need,
+                           void *data) {
+  return *(size_t *)data;
+}
+
+START_TEST(test_memarena_growth) {
+  const size_t max = 16 * 1024 * 1024;
+  mem_arena_t *arena = mem_arena_new(1);
+  mem_arena_set_growth(arena, 2, max);
+  /* 128 MiB in 4 KiB allocations */
+  for (int i = 0; i < 32 * 1024; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, 4096));
+  }
+  /* doubling up to 16 MiB, then 16 MiB regions */
+  ck_assert_int_lt(count_regions(arena), 32);
+  size_t previous = 0;
+  for (mem_arena_region_t *r = arena->head->next; r; r = r->next) {
+    ck_assert_uint_ge(r->capacity, previous);
+    ck_assert_uint_le(r->capacity, max + getpagesize() * 2);
+    previous = r->capacity;
+  }
+  mem_arena_destroy(arena);
+
+  size_t size = 1024 * 1024;
+  arena = mem_arena_new(1);
+  mem_arena_set_growth_fn(arena, fixed_growth, &size);
+  for (int i = 0; i < 1024; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, 4096));
+  }
+  for (mem_arena_region_t *r = arena->head->next; r; r = r->next) {
+    ck_assert_uint_ge(r->capacity, size);
+  }
+  ck_assert_int_le(count_regions(arena), 6);
+
+  /* an unreasonable size fails the allocation */
+  size = SIZE_MAX - 1;
+  int regions = count_regions(arena);
+  ck_assert_ptr_null(mem_alloc(arena, 2 * 1024 * 1024));
+  ck_assert_int_eq(count_regions(arena), regions);
+  mem_arena_destroy(arena);
+
+  arena = mem_arena_new_flags(1, MEM_ARENA_HUGEPAGE);
+  mem_arena_set_growth_fn(arena, fixed_growth, &size);
+  ck_assert_ptr_null(mem_alloc(arena, 4 * 1024 * 1024));
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_mark_rewind) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  char *keep = mem_strdup(arena, "before mark");
+  mem_arena_mark_t mark = mem_arena_mark(arena);
+  mem_arena_region_t *tail = arena->tail;
+  size_t used = tail->used;
+
+  for (int i = 0; i < 100; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() / 2));
+  }
+  /* nested one */
+  mem_arena_mark_t inner = mem_arena_mark(arena);
+  mem_arena_region_t *inner_tail = arena->tail;
+  for (int i = 0; i < 100; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() / 2));
+  }
+  int regions = count_regions(arena);
+  mem_arena_rewind(arena, inner);
+  ck_assert_ptr_eq(arena->tail, inner_tail);
+  mem_arena_rewind(arena, mark);
+  ck_assert_ptr_eq(arena->tail, tail);
+  ck_assert_int_eq(tail->used, used);
+  ck_assert_str_eq(keep, "before mark");
+
+  /* space is reused, no new region */
+  for (int i = 0; i < 200; i++) {
+    ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() / 2));
+  }
+  ck_assert_int_eq(count_regions(arena), regions);
+  mem_arena_rewind(arena, mark);
+
+  /* marked region moved by mremap is found back */
+  uint8_t *big = mem_alloc(arena, getpagesize() * 8);
+  mark = mem_arena_mark(arena);
+  big = mem_realloc(arena, big, getpagesize() * 64);
+  ck_assert_ptr_nonnull(big);
+  ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() * 8));
+  mem_arena_rewind(arena, mark);
+  ck_assert_uint_eq(arena->tail->id, mark.region_id);
+  ck_assert_ptr_eq(GET_REGION(big), arena->tail);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_rewind_emptied_region) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_arena_stats_t stats;
+  /* mark on an empty tail, emptied again after it by a free */
+  mem_arena_mark_t mark = mem_arena_mark(arena);
+  void *small = mem_alloc(arena, 100);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 1024 * 1024));
+  mem_free(arena, small);
+  int regions = count_regions(arena);
+  mem_arena_rewind(arena, mark);
+  mem_arena_stats(arena, &stats);
+  ck_assert_uint_eq(stats.used, 0);
+  for (mem_arena_region_t *r = arena->head; r;
+       r = (mem_arena_region_t *)r->next) {
+    ck_assert_uint_eq(r->used, 0);
+  }
+  ck_assert_ptr_eq(arena->tail, arena->head);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 1024 * 1024));
+  ck_assert_int_eq(count_regions(arena), regions);
+  mem_arena_destroy(arena);
+
+  /* same with regions used before the mark, they are kept */
+  arena = mem_arena_new(getpagesize());
+  char *keep = mem_strdup(arena, "before mark");
+  mem_arena_region_t *tail = arena->tail;
+  mem_free(arena, mem_alloc(arena, getpagesize() * 2));
+  ck_assert_ptr_ne(arena->tail, tail);
+  ck_assert_uint_eq(arena->tail->used, 0);
+  mem_arena_stats(arena, &stats);
+  size_t used = stats.used;
+  mark = mem_arena_mark(arena);
+  small = mem_alloc(arena, 100);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 1024 * 1024));
+  mem_free(arena, small);
+  mem_arena_rewind(arena, mark);
+  mem_arena_stats(arena, &stats);
+  ck_assert_uint_eq(stats.used, used);
+  ck_assert_ptr_eq(arena->tail, tail);
+  ck_assert_str_eq(keep, "before mark");
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_stats) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_arena_stats_t stats;
+  mem_arena_stats(arena, &stats);
+  ck_assert_uint_eq(stats.regions, 1);
+  ck_assert_uint_eq(stats.used, 0);
+  ck_assert_uint_eq(stats.allocs, 0);
+
+  char *a = mem_alloc(arena, 10);
+  char *b = mem_alloc(arena, 100);
+  b = mem_realloc(arena, b, 200);
+  ck_assert_ptr_nonnull(mem_alloc_nohdr(arena, 3));
+  a = mem_realloc(arena, a, 300);
+  ck_assert_ptr_nonnull(mem_alloc(arena, getpagesize() * 4));
+  mem_free(arena, a);
+  mem_arena_stats(arena, &stats);
+  ck_assert_uint_eq(stats.regions, 2);
+  ck_assert_uint_eq(stats.mmaps, 2);
+  ck_assert_uint_ge(stats.mapped, stats.capacity + 2 * sizeof(*arena->head));
+  /* realloc by copy allocates too */
+  ck_assert_uint_eq(stats.allocs, 5);
+  ck_assert_uint_eq(stats.frees, 1);
+  ck_assert_uint_eq(stats.reallocs, 2);
+  ck_assert_uint_eq(stats.reallocs_inplace, 1);
+  ck_assert_uint_eq(stats.reallocs_copy, 1);
+  ck_assert_uint_eq(stats.requested, 10 + 100 + 3 + 300 + getpagesize() * 4);
+  ck_assert_uint_ge(stats.overhead, 4 * sizeof(mem_arena_block_t));
+  ck_assert_uint_eq(stats.histogram[1], 1);
+  ck_assert_uint_eq(stats.histogram[3], 1);
+  ck_assert_uint_eq(stats.histogram[6], 1);
+  ck_assert_uint_eq(stats.histogram[8], 1);
+  ck_assert_uint_eq(stats.histogram[__builtin_ctz(getpagesize() * 4)], 1);
+  ck_assert_uint_le(stats.used, stats.capacity);
+  ck_assert_uint_ge(stats.peak, stats.used);
+
+  /* peak stays, used follows the reset */
+  size_t peak = stats.peak;
+  mem_arena_reset(arena);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 16));
+  mem_arena_stats(arena, &stats);
+  ck_assert_uint_eq(stats.peak, peak);
+  ck_assert_uint_lt(stats.used, peak);
+  ck_assert_uint_eq(stats.used, arena->stats.used);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_alloc_aligned) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  size_t aligns[] = {32, 64, 128, 4096};
+  for (size_t i = 0; i < sizeof(aligns) / sizeof(aligns[0]); i++) {
+    for (size_t size = 1; size < 3000; size += 333) {
+      ck_assert_ptr_nonnull(mem_alloc(arena, 3));
+      uint8_t *ptr = mem_alloc_aligned(arena, size, aligns[i]);
+      ck_assert_ptr_nonnull(ptr);
+      ck_assert_uint_eq((uintptr_t)ptr % aligns[i], 0);
+      ck_assert_uint_eq(mem_memsize(arena, ptr), size);
+      memset(ptr, 0xaa, size);
+    }
+  }
+  /* bigger than a region */
+  uint8_t *big = mem_alloc_aligned(arena, getpagesize() * 4, 64);
+  ck_assert_uint_eq((uintptr_t)big % 64, 0);
+  ck_assert_uint_eq(mem_memsize(arena, big), getpagesize() * 4);
+  ck_assert_ptr_null(mem_alloc_aligned(arena, 16, 48));
+  ck_assert_ptr_null(mem_alloc_aligned(arena, 16, 0));
+
+  /* freeing the last one gives its space back */
+  mem_alloc(arena, 8);
+  mem_arena_region_t *tail = arena->tail;
+  size_t used = tail->used;
+  int alloc_cnt = tail->alloc_cnt;
+  void *ptr = mem_alloc_aligned(arena, 100, 256);
+  ck_assert_ptr_eq(GET_REGION(ptr), tail);
+  mem_free(arena, ptr);
+  ck_assert_uint_le(tail->used, used + 256);
+  ck_assert_int_eq(tail->alloc_cnt, alloc_cnt);
+
+  /* realloc keeps alignment and content, in place or moved */
+  mem_arena_reset(arena);
+  uint8_t *vec = mem_realloc_aligned(arena, NULL, 10, 64);
+  ck_assert_uint_eq((uintptr_t)vec % 64, 0);
+  memset(vec, 1, 10);
+  for (size_t size = 20; size < getpagesize() * 16; size *= 2) {
+    mem_alloc(arena, 1);
+    vec = mem_realloc_aligned(arena, vec, size, 64);
+    ck_assert_ptr_nonnull(vec);
+    ck_assert_uint_eq((uintptr_t)vec % 64, 0);
+    ck_assert_uint_eq(vec[0], 1);
+    ck_assert_uint_eq(vec[9], 1);
+  }
+  /* default alignment to a bigger one */
+  uint8_t *p16 = mem_alloc(arena, 16);
+  if ((uintptr_t)p16 % 64 == 0) {
+    p16 = mem_alloc(arena, 16);
+  }
+  memset(p16, 2, 16);
+  uint8_t *p64 = mem_realloc_aligned(arena, p16, 16, 64);
+  ck_assert_uint_eq((uintptr_t)p64 % 64, 0);
+  ck_assert_uint_eq(p64[15], 2);
+  mem_arena_destroy(arena);
+
+  arena = mem_arena_new_flags(getpagesize(), MEM_ARENA_CONCURRENT);
+  for (int i = 0; i < 100; i++) {
+    mem_alloc(arena, 5);
+    uint8_t *ptr = mem_alloc_aligned(arena, 40, 64);
+    ck_assert_uint_eq((uintptr_t)ptr % 64, 0);
+    ck_assert_uint_eq(mem_memsize(arena, ptr), 40);
+  }
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+struct node {
+  struct node *next;
+  int value;
+};
+
+struct line {
+  _Alignas(64) long counter;
+};
+
+START_TEST(test_memarena_alloc_inline) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  struct node *list = NULL;
+  for (int i = 0; i < 1000; i++) {
+    struct node *node = MEM_NEW(arena, struct node);
+    ck_assert_ptr_nonnull(node);
+    ck_assert_uint_eq((uintptr_t)node % MEMARENA_ALIGNMENT, 0);
+    ck_assert_uint_eq(mem_memsize(arena, node), sizeof(*node));
+    node->value = i;
+    node->next = list;
+    list = node;
+  }
+  for (int i = 999; list; list = list->next, i--) {
+    ck_assert_int_eq(list->value, i);
+  }
+  ck_assert_int_gt(count_regions(arena), 1);
+
+  /* same bookkeeping as mem_alloc */
+  mem_arena_reset(arena);
+  char *a = mem_alloc_inline(arena, 10);
+  char *b = mem_alloc(arena, 10);
+  ck_assert_ptr_eq(b, a + MEMARENA_ALIGNED_SIZE(10) + MEMARENA_HEADER_SIZE);
+  ck_assert_ptr_eq(arena->tail->last_alloc, b);
+  ck_assert_int_eq(arena->tail->alloc_cnt, 2);
+  mem_free(arena, b);
+  mem_free(arena, a);
+  ck_assert_uint_eq(arena->tail->used, 0);
+  ck_assert_ptr_null(mem_alloc_inline(arena, 0));
+  ck_assert_ptr_null(mem_alloc_inline(NULL, 10));
+
+  struct line *lines = MEM_NEW_ARRAY(arena, struct line, 8);
+  ck_assert_uint_eq((uintptr_t)lines % 64, 0);
+  ck_assert_uint_eq(mem_memsize(arena, lines), 8 * sizeof(struct line));
+  ck_assert_ptr_null(MEM_NEW_ARRAY(arena, struct line, SIZE_MAX / 8));
+  ck_assert_ptr_null(MEM_NEW_ARRAY(arena, int, 0));
+  mem_arena_destroy(arena);
+
+  /* concurrent arena goes through mem_alloc */
+  arena = mem_arena_new_flags(getpagesize(), MEM_ARENA_CONCURRENT);
+  ck_assert_ptr_nonnull(MEM_NEW(arena, struct node));
+  ck_assert_ptr_null(arena->tail->last_alloc);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_vec) {
+  mem_vec_t *vec = NULL;
+  mem_arena_t *arena =
+      mem_arena_new_embed(getpagesize(), sizeof(*vec), (void **)&vec);
+  mem_vec_init(vec, arena, sizeof(int));
+  ck_assert_uint_eq(mem_vec_length(vec), 0);
+  ck_assert_ptr_null(mem_vec_at(vec, 0));
+  ck_assert_int_eq(mem_vec_pop(vec, NULL), -1);
+
+  /* alone in the region, it grows in place */
+  for (int i = 0; i < 100; i++) {
+    ck_assert_ptr_nonnull(mem_vec_push(vec, &i));
+  }
+  void *data = mem_vec_data(vec);
+  for (int i = 100; i < 500; i++) {
+    ck_assert_ptr_nonnull(mem_vec_push(vec, &i));
+  }
+  ck_assert_ptr_eq(mem_vec_data(vec), data);
+  ck_assert_uint_eq(mem_vec_length(vec), 500);
+  for (int i = 0; i < 500; i++) {
+    ck_assert_int_eq(*(int *)mem_vec_at(vec, i), i);
+  }
+
+  /* something allocated after it, growth moves it */
+  ck_assert_ptr_nonnull(mem_alloc(arena, 8));
+  int more[1000];
+  for (int i = 0; i < 1000; i++) {
+    more[i] = 500 + i;
+  }
+  ck_assert_ptr_nonnull(mem_vec_append(vec, more, 1000));
+  ck_assert_ptr_ne(mem_vec_data(vec), data);
+  ck_assert_uint_eq(mem_vec_length(vec), 1500);
+  ck_assert_uint_ge(vec->capacity, 1500);
+  for (int i = 0; i < 1500; i++) {
+    ck_assert_int_eq(((int *)mem_vec_data(vec))[i], i);
+  }
+  int last = 0;
+  ck_assert_int_eq(mem_vec_pop(vec, &last), 0);
+  ck_assert_int_eq(last, 1499);
+
+  /* shrink gives the end of the region back */
+  mem_arena_region_t *region = GET_REGION(mem_vec_data(vec));
+  size_t used = region->used;
+  mem_vec_shrink(vec);
+  ck_assert_uint_eq(vec->capacity, 1499);
+  ck_assert_uint_le(region->used, used);
+  ck_assert_int_eq(*(int *)mem_vec_at(vec, 1498), 1498);
+
+  /* reset empties it */
+  mem_arena_reset(arena);
+  ck_assert_uint_eq(mem_vec_length(vec), 0);
+  ck_assert_ptr_null(mem_vec_data(vec));
+  ck_assert_ptr_nonnull(mem_vec_push(vec, &last));
+  ck_assert_int_eq(*(int *)mem_vec_at(vec, 0), 1499);
+  mem_vec_clear(vec);
+  ck_assert_uint_eq(mem_vec_length(vec), 0);
+  ck_assert_uint_ge(vec->capacity, 1);
+
+  mem_vec_t *in_arena = mem_vec_new(arena, sizeof(double));
+  ck_assert_int_eq(mem_vec_reserve(in_arena, 100), 0);
+  ck_assert_uint_ge(in_arena->capacity, 100);
+  ck_assert_ptr_null(mem_vec_append(in_arena, NULL, SIZE_MAX));
+  ck_assert_uint_eq(in_arena->capacity, 100);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_str) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_str_t str;
+  mem_str_init(&str, arena);
+  ck_assert_str_eq(mem_str_cstr(&str), "");
+  ck_assert_ptr_null(mem_str_finish(&str));
+
+  ck_assert_int_eq(mem_str_appends(&str, "hello"), 0);
+  ck_assert_int_eq(mem_str_appendc(&str, ' '), 0);
+  ck_assert_int_eq(mem_str_append(&str, "world!!", 5), 0);
+  ck_assert_int_eq(mem_str_printf(&str, " %d %s", 42, "end"), 0);
+  ck_assert_str_eq(mem_str_cstr(&str), "hello world 42 end");
+  ck_assert_uint_eq(mem_str_length(&str), 18);
+
+  /* last allocation of its region, grows in place */
+  const char *data = mem_str_cstr(&str);
+  for (int i = 0; i < 100; i++) {
+    ck_assert_int_eq(mem_str_printf(&str, "%02d", i), 0);
+  }
+  ck_assert_ptr_eq(mem_str_cstr(&str), data);
+  ck_assert_uint_eq(mem_str_length(&str), 218);
+  char *first = mem_str_finish(&str);
+  ck_assert_uint_eq(strlen(first), 218);
+  ck_assert_int_eq(strncmp(first + 18, "00010203", 8), 0);
+  ck_assert_uint_eq(mem_memsize(arena, first), 219);
+
+  /* builder starts over, formatting bigger than the room left */
+  char big[3000];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  ck_assert_int_eq(mem_str_printf(&str, "[%s]", big), 0);
+  ck_assert_int_eq(mem_str_printf(&str, "%s", big), 0);
+  ck_assert_uint_eq(mem_str_length(&str), 2 * 2999 + 2);
+  char *second = mem_str_finish(&str);
+  ck_assert_int_eq(second[0], '[');
+  ck_assert_int_eq(second[3000], ']');
+  ck_assert_uint_eq(strlen(second), 6000);
+  ck_assert_str_eq(first + 202, "9293949596979899");
+
+  /* reset empties it */
+  mem_str_appends(&str, "gone");
+  mem_arena_reset(arena);
+  ck_assert_uint_eq(mem_str_length(&str), 0);
+  ck_assert_int_eq(mem_str_appends(&str, "new"), 0);
+  ck_assert_str_eq(mem_str_finish(&str), "new");
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_intern) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_intern_t table;
+  mem_intern_init(&table, arena);
+  ck_assert_ptr_null(mem_intern_lookup(&table, "a", 1));
+
+  const char *a = mem_intern(&table, "identifier");
+  char copy[] = "identifier";
+  ck_assert_ptr_eq(mem_intern(&table, copy), a);
+  ck_assert_ptr_eq(mem_intern_n(&table, "identifier_2", 10), a);
+  ck_assert_ptr_ne(mem_intern(&table, "identifier_2"), a);
+  ck_assert_ptr_eq(mem_intern_lookup(&table, "identifier", 10), a);
+  ck_assert_ptr_null(mem_intern_lookup(&table, "identifie", 9));
+  const char *empty = mem_intern(&table, "");
+  ck_assert_str_eq(empty, "");
+  ck_assert_ptr_eq(mem_intern_n(&table, "x", 0), empty);
+
+  /* many strings, short and long, through a few growths */
+  char key[256];
+  const char *interned[2000];
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(key, sizeof(key), "key%d", i);
+    if (i % 10 == 0) {
+      memset(key + len, 'z', 100);
+      key[len + 100] = '\0';
+    }
+    interned[i] = mem_intern(&table, key);
+    ck_assert_str_eq(interned[i], key);
+  }
+  ck_assert_uint_eq(mem_intern_count(&table), 2003);
+  ck_assert_uint_ge(table.capacity, 2003 * 4 / 3);
+  for (int i = 0; i < 2000; i++) {
+    int len = snprintf(key, sizeof(key), "key%d", i);
+    if (i % 10 == 0) {
+      memset(key + len, 'z', 100);
+      key[len + 100] = '\0';
+    }
+    ck_assert_ptr_eq(mem_intern(&table, key), interned[i]);
+  }
+  ck_assert_uint_eq(mem_intern_count(&table), 2003);
+
+  /* reset empties it, another arena keeps it */
+  mem_arena_reset(arena);
+  ck_assert_uint_eq(mem_intern_count(&table), 0);
+  ck_assert_ptr_null(mem_intern_lookup(&table, "identifier", 10));
+  ck_assert_str_eq(mem_intern(&table, "identifier"), "identifier");
+
+  mem_arena_t *keep = mem_arena_new(getpagesize());
+  mem_intern_t kept;
+  mem_intern_init(&kept, keep);
+  a = mem_intern(&kept, "survivor");
+  mem_arena_reset(arena);
+  ck_assert_ptr_eq(mem_intern(&kept, "survivor"), a);
+  mem_arena_destroy(keep);
+
+  /* rebuilt, or kept with its own arena */
+  mem_intern_t rebuilt, persistent;
+  ck_assert_int_eq(mem_intern_init_flags(&rebuilt, arena, 0), 0);
+  ck_assert_int_eq(
+      mem_intern_init_flags(&persistent, arena, MEM_INTERN_PERSISTENT), 0);
+  ck_assert_ptr_ne(persistent.arena, arena);
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    interned[i] = mem_intern(&persistent, key);
+    ck_assert_ptr_nonnull(mem_intern(&rebuilt, key));
+  }
+  mem_arena_reset(arena);
+  memset(mem_alloc(arena, 64 * 1024), 0xAA, 64 * 1024);
+  ck_assert_uint_eq(mem_intern_count(&rebuilt), 0);
+  ck_assert_ptr_null(mem_intern_lookup(&rebuilt, "key1", 4));
+  ck_assert_uint_eq(mem_intern_count(&persistent), 100);
+  for (int i = 0; i < 100; i++) {
+    int len = snprintf(key, sizeof(key), "key%d", i);
+    ck_assert_ptr_eq(mem_intern_lookup(&persistent, key, len), interned[i]);
+    ck_assert_str_eq(interned[i], key);
+  }
+  mem_intern_destroy(&rebuilt);
+  mem_intern_destroy(&persistent);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_freelist) {
+  mem_arena_t *arena = mem_arena_new_flags(getpagesize(), MEM_ARENA_FREELIST);
+  void *small[8];
+  for (int i = 0; i < 8; i++) {
+    small[i] = mem_alloc(arena, 24);
+  }
+  void *big = mem_alloc(arena, 1000);
+  void *last = mem_alloc(arena, 8);
+  mem_arena_region_t *tail = arena->tail;
+  size_t used = tail->used;
+
+  /* interior blocks come back, last in first out, without bumping */
+  mem_free(arena, small[2]);
+  mem_free(arena, small[5]);
+  ck_assert_ptr_eq(mem_alloc(arena, 20), small[5]);
+  ck_assert_ptr_eq(mem_alloc(arena, 32), small[2]);
+  ck_assert_uint_eq(mem_memsize(arena, small[2]), 32);
+  ck_assert_uint_eq(tail->used, used);
+
+  /* bigger blocks are taken by anything they fit */
+  mem_free(arena, big);
+  ck_assert_ptr_eq(mem_alloc(arena, 700), big);
+  ck_assert_uint_eq(tail->used, used);
+  ck_assert_uint_eq(arena->stats.reuses, 3);
+
+  /* a listed block keeps its region in use */
+  for (int i = 0; i < 8; i++) {
+    mem_free(arena, small[i]);
+  }
+  mem_free(arena, big);
+  ck_assert_int_eq(tail->alloc_cnt, 10);
+  /* the last allocation still gives its space back */
+  mem_free(arena, last);
+  ck_assert_uint_eq(tail->used, used - MEMARENA_HEADER_SIZE -
+                                    MEMARENA_ALIGNED_SIZE(8));
+
+  /* steady churn doesn't grow the arena */
+  for (int round = 0; round < 1000; round++) {
+    void *a = mem_alloc(arena, 16 + round % 200);
+    void *b = mem_alloc(arena, 8);
+    mem_free(arena, a);
+    mem_free(arena, b);
+  }
+  ck_assert_int_eq(count_regions(arena), 1);
+
+  /* copied realloc lists the old block */
+  void *grow = mem_alloc(arena, 16);
+  mem_alloc(arena, 8);
+  void *moved = mem_realloc(arena, grow, 64);
+  ck_assert_ptr_ne(moved, grow);
+  ck_assert_ptr_eq(mem_alloc(arena, 16), grow);
+
+  /* lists are dropped with the blocks */
+  mem_free(arena, grow);
+  mem_arena_reset(arena);
+  ck_assert_ptr_null(arena->free_small[0]);
+  ck_assert_uint_eq(arena->free_mask, 0);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_pool) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_pool_t pool;
+  mem_pool_init(&pool, arena, 40, 0, 0);
+  ck_assert_uint_eq(pool.object_size, MEMARENA_ALIGNED_SIZE(40));
+
+  /* objects are packed, without header */
+  char *a = mem_pool_alloc(&pool);
+  char *b = mem_pool_alloc(&pool);
+  ck_assert_ptr_eq(b, a + pool.object_size);
+  ck_assert_uint_eq((uintptr_t)a % MEMARENA_ALIGNMENT, 0);
+
+  /* freed objects come back first */
+  mem_pool_free(&pool, a);
+  mem_pool_free(&pool, b);
+  ck_assert_ptr_eq(mem_pool_alloc(&pool), b);
+  ck_assert_ptr_eq(mem_pool_alloc(&pool), a);
+
+  /* steady churn is served by the free list */
+  size_t mapped = arena->stats.mapped;
+  void *live[100];
+  for (int i = 0; i < 100; i++) {
+    live[i] = mem_pool_alloc(&pool);
+  }
+  for (int round = 0; round < 10000; round++) {
+    mem_pool_free(&pool, live[round % 100]);
+    live[round % 100] = mem_pool_alloc(&pool);
+    memset(live[round % 100], 0xAA, 40);
+  }
+  ck_assert_uint_eq(arena->stats.mapped, mapped);
+
+  /* a reset releases everything, the pool starts over */
+  mem_arena_reset(arena);
+  ck_assert_ptr_nonnull(mem_pool_alloc(&pool));
+  ck_assert_ptr_null(pool.free);
+
+  mem_pool_t *aligned = mem_pool_new(arena, 8, 256, 0);
+  ck_assert_uint_eq(aligned->object_size, 256);
+  for (int i = 0; i < 100; i++) {
+    ck_assert_uint_eq((uintptr_t)mem_pool_alloc(aligned) % 256, 0);
+  }
+  ck_assert_ptr_null(mem_pool_new(arena, 8, 24, 0));
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+#define POOL_THREADS 4
+#define POOL_CACHES 8 /* thread cache slots */
+#define POOL_LIVE 200
+
+static void *pool_worker(void *arg) {
+  mem_pool_t *pool = arg;
+  uint64_t *live[POOL_LIVE] = {NULL};
+  for (int round = 0; round < 20000; round++) {
+    uint64_t **slot = &live[round % POOL_LIVE];
+    if (*slot) {
+      /* nobody else wrote in it */
+      if (**slot != (uint64_t)(uintptr_t)slot) {
+        return slot;
+      }
+      mem_pool_free(pool, *slot);
+    }
+    *slot = mem_pool_alloc(pool);
+    if (*slot == NULL) {
+      return slot;
+    }
+    **slot = (uint64_t)(uintptr_t)slot;
+  }
+  for (int i = 0; i < POOL_LIVE; i++) {
+    mem_pool_free(pool, live[i]);
+  }
+  return NULL;
+}
+
+START_TEST(test_memarena_pool_threads) {
+  mem_arena_t *arena = mem_arena_new_flags(0, MEM_ARENA_CONCURRENT);
+  mem_pool_t pool;
+  mem_pool_init(&pool, arena, sizeof(uint64_t), 0, MEM_POOL_THREAD_CACHE);
+  pthread_t threads[POOL_THREADS];
+  for (int t = 0; t < POOL_THREADS; t++) {
+    pthread_create(&threads[t], NULL, pool_worker, &pool);
+  }
+  for (int t = 0; t < POOL_THREADS; t++) {
+    void *failed = NULL;
+    pthread_join(threads[t], &failed);
+    ck_assert_ptr_null(failed);
+  }
+  /* the objects were reused, not only cut from slabs */
+  size_t slabs = arena->stats.allocs;
+  ck_assert_uint_lt(slabs * (MEMARENA_POOL_SLAB / pool.object_size),
+                    POOL_THREADS * 20000);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_pool_cache_slots) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  mem_pool_t pools[POOL_CACHES + 1];
+  /* two pools falling in the same slot */
+  mem_pool_init(&pools[0], arena, 64, 0, MEM_POOL_THREAD_CACHE);
+  do {
+    mem_pool_init(&pools[1], arena, 64, 0, MEM_POOL_THREAD_CACHE);
+  } while ((pools[1].id - pools[0].id) % POOL_CACHES != 0);
+  for (int round = 0; round < 10000; round++) {
+    for (int p = 0; p < 2; p++) {
+      void *ptr = mem_pool_alloc(&pools[p]);
+      ck_assert_ptr_nonnull(ptr);
+      memset(ptr, p, 64);
+      mem_pool_free(&pools[p], ptr);
+    }
+  }
+  /* each kept its cache, a single slab each */
+  ck_assert_uint_eq(arena->stats.allocs, 2);
+
+  /* more pools than slots, evicted caches go back to their pool, arenas
+   * destroyed meanwhile don't matter */
+  for (int p = 2; p <= POOL_CACHES; p++) {
+    mem_pool_init(&pools[p], arena, 64, 0, MEM_POOL_THREAD_CACHE);
+  }
+  for (int round = 0; round < 10000; round++) {
+    for (int p = 0; p <= POOL_CACHES; p++) {
+      void *ptr = mem_pool_alloc(&pools[p]);
+      ck_assert_ptr_nonnull(ptr);
+      memset(ptr, p, 64);
+      mem_pool_free(&pools[p], ptr);
+    }
+    if (round % 100 == 0) {
+      mem_arena_destroy(mem_arena_new(0));
+    }
+  }
+  ck_assert_uint_eq(arena->stats.allocs, POOL_CACHES + 1);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+typedef struct {
+  mem_pool_t *doomed;
+  mem_pool_t *pools; /* POOL_CACHES of them */
+  pthread_barrier_t barrier;
+} pool_evict_job_t;
+
+static void *pool_evict_worker(void *arg) {
+  pool_evict_job_t *job = arg;
+  mem_pool_free(job->doomed, mem_pool_alloc(job->doomed));
+  /* the doomed pool and its arena are destroyed by the other thread */
+  pthread_barrier_wait(&job->barrier);
+  pthread_barrier_wait(&job->barrier);
+  /* its slot is the least recently used, taken over by these */
+  for (int round = 0; round < 100; round++) {
+    for (int p = 0; p < POOL_CACHES; p++) {
+      void *ptr = mem_pool_alloc(&job->pools[p]);
+      if (ptr == NULL) {
+        return job;
+      }
+      memset(ptr, p, 64);
+      mem_pool_free(&job->pools[p], ptr);
+    }
+  }
+  return NULL;
+}
+
+START_TEST(test_memarena_pool_cache_destroyed) {
+  mem_arena_t *doomed_arena = mem_arena_new(0);
+  mem_pool_t *doomed =
+      mem_pool_new(doomed_arena, 64, 0, MEM_POOL_THREAD_CACHE);
+  mem_arena_t *arena = mem_arena_new_flags(0, MEM_ARENA_CONCURRENT);
+  mem_pool_t pools[POOL_CACHES];
+  for (int p = 0; p < POOL_CACHES; p++) {
+    mem_pool_init(&pools[p], arena, 64, 0, MEM_POOL_THREAD_CACHE);
+  }
+  pool_evict_job_t job = {doomed, pools};
+  pthread_barrier_init(&job.barrier, NULL, 2);
+  pthread_t thread;
+  pthread_create(&thread, NULL, pool_evict_worker, &job);
+  pthread_barrier_wait(&job.barrier);
+  mem_arena_destroy(doomed_arena);
+  pthread_barrier_wait(&job.barrier);
+  void *failed = NULL;
+  pthread_join(thread, &failed);
+  ck_assert_ptr_null(failed);
+  pthread_barrier_destroy(&job.barrier);
+
+  /* a new pool gets nothing of the doomed one, its objects are its own */
+  mem_arena_t *other = mem_arena_new(0);
+  mem_pool_t pool;
+  mem_pool_init(&pool, other, 64, 0, MEM_POOL_THREAD_CACHE);
+  for (int i = 0; i < 100; i++) {
+    uint8_t *ptr = mem_pool_alloc(&pool);
+    int own = 0;
+    for (mem_arena_region_t *r = other->head; r; r = r->next) {
+      own |= ptr >= r->data && ptr < r->data + r->used;
+    }
+    ck_assert(own);
+  }
+  mem_arena_destroy(other);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_child) {
+  mem_arena_t *parent = mem_arena_new(64 * 1024);
+  mem_arena_region_t *region = parent->head;
+  size_t mmaps = parent->stats.mmaps;
+
+  /* regions of the child, and of its child, are parent blocks */
+  mem_arena_t *child = mem_arena_new_child(parent, 1024);
+  ck_assert_ptr_nonnull(child);
+  ck_assert_ptr_eq(child->parent, parent);
+  for (int i = 0; i < 20; i++) {
+    char *ptr = mem_alloc(child, 200);
+    memset(ptr, 'c', 200);
+  }
+  ck_assert_int_gt(count_regions(child), 1);
+  mem_arena_t *grandchild = mem_arena_new_child(child, 512);
+  ck_assert_ptr_nonnull(mem_alloc(grandchild, 2000));
+  ck_assert_uint_eq(parent->stats.mmaps, mmaps);
+  ck_assert_uint_eq(child->stats.mmaps, 0);
+  ck_assert_int_eq(region->alloc_cnt, count_regions(child));
+
+  /* destroyed, every block is freed and the parent region is empty again */
+  mem_arena_destroy(grandchild);
+  mem_arena_destroy(child);
+  ck_assert_int_eq(region->alloc_cnt, 0);
+  ck_assert_uint_eq(region->used, 0);
+
+  /* a parent reset releases children without destroying them */
+  child = mem_arena_new_child(parent, 0);
+  mem_alloc(child, 3000);
+  mem_arena_reset(parent);
+  ck_assert_uint_eq(region->used, 0);
+
+  ck_assert_ptr_null(mem_arena_new_child(NULL, 0));
+  mem_arena_destroy(parent);
+}
+END_TEST
+
+/* pages of [start, start + length) in memory */
+static size_t resident_pages(const void *start, size_t length) {
+  size_t pagesize = getpagesize();
+  uintptr_t first = (uintptr_t)start & ~(pagesize - 1);
+  size_t count = ((uintptr_t)start + length - first + pagesize - 1) / pagesize;
+  unsigned char *vec = malloc(count);
+  size_t resident = 0;
+  if (mincore((void *)first, count * pagesize, vec) == 0) {
+    for (size_t i = 0; i < count; i++) {
+      resident += vec[i] & 1;
+    }
+  }
+  free(vec);
+  return resident;
+}
+
+START_TEST(test_memarena_prefault) {
+  size_t pagesize = getpagesize();
+  mem_arena_t *arena = mem_arena_new_flags(256 * 1024, MEM_ARENA_POPULATE);
+  mem_arena_region_t *region = arena->head;
+  ck_assert_uint_eq(region->prefaulted, region->capacity);
+  ck_assert_uint_eq(resident_pages(region->data, region->capacity),
+                    (region->capacity + pagesize - 1) / pagesize);
+  mem_arena_destroy(arena);
+
+  /* populated ahead of the bump as it moves */
+  arena = mem_arena_new(1024 * 1024);
+  region = arena->tail;
+  mem_arena_set_prefault(arena, 64 * 1024);
+  ck_assert_uint_ge(region->prefaulted, region->used + 64 * 1024);
+  for (int i = 0; i < 1000; i++) {
+    char *ptr = mem_alloc_inline(arena, 300);
+    ck_assert_uint_gt(region->data + region->prefaulted - (uint8_t *)ptr,
+                      32 * 1024);
+  }
+  ck_assert_uint_ge(resident_pages(region->data + region->used, 30 * 1024),
+                    30 * 1024 / pagesize);
+  mem_arena_set_prefault(arena, 0);
+  ck_assert_uint_eq(arena->prefault_ahead, 0);
+  mem_arena_destroy(arena);
+
+  /* concurrent arenas don't prefault */
+  arena = mem_arena_new_flags(0, MEM_ARENA_CONCURRENT);
+  mem_arena_set_prefault(arena, 64 * 1024);
+  ck_assert_uint_eq(arena->prefault_ahead, 0);
+  mem_arena_destroy(arena);
+
+  /* prewarmed up to 4 MiB, allocations below need no new region */
+  arena = mem_arena_new(64 * 1024);
+  ck_assert_int_eq(mem_arena_prewarm(arena, 4 * 1024 * 1024), 0);
+  ck_assert_int_eq(count_regions(arena), 2);
+  size_t mmaps = arena->stats.mmaps;
+  for (int i = 0; i < 3 * 1024; i++) {
+    mem_alloc(arena, 1000);
+  }
+  ck_assert_uint_eq(arena->stats.mmaps, mmaps);
+  ck_assert_int_eq(count_regions(arena), 2);
+  ck_assert_int_eq(mem_arena_prewarm(arena, 0), 0);
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+static int all_zero(const void *ptr, size_t size) {
+  const unsigned char *bytes = ptr;
+  for (size_t i = 0; i < size; i++) {
+    if (bytes[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+START_TEST(test_memarena_calloc) {
+  mem_arena_t *arena = mem_arena_new(64 * 1024);
+  mem_arena_region_t *region = arena->tail;
+
+  /* fresh memory, nothing used before */
+  char *a = mem_calloc(arena, 10, 100);
+  ck_assert(all_zero(a, 1000));
+  ck_assert_uint_eq(region->dirty, 0);
+  memset(a, 0xff, 1000);
+  char *b = mem_calloc(arena, 1, 500);
+  ck_assert(all_zero(b, 500));
+  memset(b, 0xff, 500);
+
+  /* given back, the dirty mark remembers it */
+  size_t used = region->used;
+  mem_free(arena, b);
+  ck_assert_uint_eq(region->dirty, used);
+  b = mem_calloc(arena, 1, 800);
+  ck_assert(all_zero(b, 800));
+  mem_arena_reset(arena);
+  a = mem_calloc(arena, 3000, 1);
+  ck_assert(all_zero(a, 3000));
+  ck_assert_ptr_null(mem_calloc(arena, SIZE_MAX / 4, 8));
+
+  /* grown bytes are zero, in place after a shrink or moved */
+  a = mem_alloc(arena, 100);
+  memset(a, 0xff, 100);
+  a = mem_realloc(arena, a, 10);
+  a = mem_realloc_zero(arena, a, 200);
+  ck_assert_uint_eq((unsigned char)a[9], 0xff);
+  ck_assert(all_zero(a + 10, 190));
+  mem_alloc(arena, 8);
+  a = mem_realloc_zero(arena, a, 5000);
+  ck_assert_uint_eq((unsigned char)a[9], 0xff);
+  ck_assert(all_zero(a + 10, 4990));
+  mem_arena_destroy(arena);
+
+  /* reused blocks are cleared */
+  arena = mem_arena_new_flags(0, MEM_ARENA_FREELIST);
+  a = mem_alloc(arena, 64);
+  mem_alloc(arena, 8);
+  memset(a, 0xff, 64);
+  mem_free(arena, a);
+  ck_assert_ptr_eq(mem_calloc(arena, 8, 8), a);
+  ck_assert(all_zero(a, 64));
+  mem_arena_destroy(arena);
+
+  /* memory of a parent arena was used */
+  mem_arena_t *parent = mem_arena_new(0);
+  memset(mem_alloc(parent, 2000), 0xff, 2000);
+  mem_arena_reset(parent);
+  mem_arena_t *child = mem_arena_new_child(parent, 1024);
+  ck_assert_uint_eq(child->head->dirty, child->head->capacity);
+  ck_assert(all_zero(mem_calloc(child, 1, 1000), 1000));
+  mem_arena_destroy(parent);
+
+  /* pages given back with MADV_DONTNEED are zero again */
+  arena = mem_arena_new(256 * 1024);
+  region = arena->tail;
+  memset(mem_alloc(arena, 200 * 1024), 0xff, 200 * 1024);
+  mem_arena_set_trim(arena, 0, 0);
+  /* the high water mark decays by a quarter each time */
+  for (int i = 0; i < 3; i++) {
+    mem_arena_reset_trim(arena);
+  }
+  ck_assert_uint_lt(region->dirty, 150 * 1024);
+  ck_assert(all_zero(mem_calloc(arena, 1, 250 * 1024), 250 * 1024));
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_strndup_freelist) {
+  mem_arena_t *arena = mem_arena_new_flags(0, MEM_ARENA_FREELIST);
+  ck_assert_ptr_nonnull(mem_alloc(arena, 40));
+  char *b = mem_alloc(arena, 40);
+  char *c = mem_alloc(arena, 40);
+  memset(c, 'c', 40);
+  size_t used = arena->tail->used;
+  mem_free(arena, b);
+  /* gets the listed block, not the last one, nothing is cut */
+  char *dup = mem_strndup(arena, "hi", 39);
+  ck_assert_ptr_eq(dup, b);
+  ck_assert_str_eq(dup, "hi");
+  ck_assert_uint_eq(arena->tail->used, used);
+  char *d = mem_alloc(arena, 40);
+  ck_assert_ptr_ne(d, c);
+  memset(d, 'd', 40);
+  for (int i = 0; i < 40; i++) {
+    ck_assert_int_eq(c[i], 'c');
+  }
+  mem_arena_destroy(arena);
+}
+END_TEST
+
+START_TEST(test_memarena_strndup_bounded) {
+  mem_arena_t *arena = mem_arena_new(getpagesize());
+  /* not NUL terminated, reading past it is caught by the sanitizer */
+  char *raw = malloc(16);
+  memset(raw, 'a', 16);
+  char *dup = mem_strndup(arena, raw, 16);
+  ck_assert_uint_eq(strlen(dup), 16);
+  dup = mem_strndup(arena, raw, 5);
+  ck_assert_str_eq(dup, "aaaaa");
+  free(raw);
+
+  /* the unused end of the bound is given back */
+  mem_arena_region_t *tail = arena->tail;
+  size_t used = tail->used;
+  dup = mem_strndup(arena, "abc", 100);
+  ck_assert_str_eq(dup, "abc");
+  ck_assert_uint_eq(mem_memsize(arena, dup), 4);
+  ck_assert_uint_eq(tail->used,
+                    used + MEMARENA_HEADER_SIZE + MEMARENA_ALIGNED_SIZE(4));
+
+  /* bound bigger than any region, nothing more than needed allocated */
+  dup = mem_strndup(arena, "short", SIZE_MAX);
+  ck_assert_str_eq(dup, "short");
+  ck_assert_int_eq(count_regions(arena), 1);
+
+  const char *strings[] = {"first", "", "third one"};
+  char *out[3];
+  char *block = mem_strdup_batch(arena, strings, 3, out);
+  ck_assert_ptr_eq(block, out[0]);
+  ck_assert_str_eq(out[0], "first");
+  ck_assert_str_eq(out[1], "");
+  ck_assert_str_eq(out[2], "third one");
+  ck_assert_ptr_eq(out[2], block + 7);
+  ck_assert_uint_eq(mem_memsize(arena, block), 17);
+
+  const char *line = "2024-01-01 INFO started";
+  const char *fields[] = {line, line + 11, line + 16};
+  size_t lengths[] = {10, 4, 100};
+  block = mem_strndup_batch(arena, fields, lengths, 3, out);
+  ck_assert_ptr_nonnull(block);
+  ck_assert_str_eq(out[0], "2024-01-01");
+  ck_assert_str_eq(out[1], "INFO");
+  ck_assert_str_eq(out[2], "started");
+  ck_assert_ptr_null(mem_strndup_batch(arena, fields, NULL, 3, out));
+  mem_arena_destroy(arena);
+}
+END_TEST
+
 START_TEST(test_mem_memsize) {
   mem_arena_t *a = mem_arena_new(getpagesize());
   ck_assert_ptr_nonnull(a);
@@ -240,87 +1705,6 @@ START_TEST(test_bigsize_bug) {
 }
 END_TEST
 
-START_TEST(test_performance) {
-  struct timespec start = {0}, end = {0};
-  long long unsigned int ns1 = 0, ns2 = 0;
-  const size_t alloc_step = 1024 * 16; /* alloc in 16k step */
-  /* request small for arena creation */
-  mem_arena_t *a = mem_arena_new(1);
-
-  /* from 16k to 128m */
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    void *ptr = mem_alloc(a, i * alloc_step);
-    mem_free(a, ptr);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    ns1 += end.tv_nsec - start.tv_nsec;
-  }
-
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    void *ptr = malloc(i * alloc_step);
-    free(ptr);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    ns2 += end.tv_nsec - start.tv_nsec;
-  }
-  ck_assert_int_lt(ns1, ns2);
-
-  /* new arena */
-  mem_arena_destroy(a);
-  a = mem_arena_new(1);
-
-  ns1 = 0;
-  ns2 = 0;
-  /* from 16k to 128m */
-  void *ptr = NULL;
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    ptr = mem_realloc(a, ptr, i * alloc_step);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    memset(ptr, i, i * alloc_step);
-    ns1 += end.tv_nsec - start.tv_nsec;
-  }
-  ptr = NULL;
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    ptr = realloc(ptr, i * alloc_step);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    memset(ptr, i, i * alloc_step);
-    ns2 += end.tv_nsec - start.tv_nsec;
-  }
-  free(ptr);
-  /* should be slower, as std realloc is better optimized */
-  ck_assert_int_gt(ns1, ns2);
-
-  /* if arena is tuned, should be faster */
-  mem_arena_destroy(a);
-  a = mem_arena_new(alloc_step * 80);
-
-  ns1 = 0;
-  ns2 = 0;
-  /* from 16k to 128m */
-  ptr = NULL;
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    ptr = mem_realloc(a, ptr, i * alloc_step);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    memset(ptr, i, i * alloc_step);
-    ns1 += end.tv_nsec - start.tv_nsec;
-  }
-  ptr = NULL;
-  for (int i = 1; i < 80; i++) {
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    ptr = realloc(ptr, i * alloc_step);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    memset(ptr, i, i * alloc_step);
-    ns2 += end.tv_nsec - start.tv_nsec;
-  }
-  free(ptr);
-  /* should be slower, as std realloc is better optimized */
-  ck_assert_int_lt(ns1, ns2);
-}
-END_TEST
-
 Suite *test_memarena_suite(void) {
   Suite *s;
   s = suite_create("Memarena Test");
@@ -333,10 +1717,19 @@ Suite *test_memarena_suite(void) {
   tcase_add_test(tc_malloc, test_memarena_malloc);
   suite_add_tcase(s, tc_malloc);
 
+  TCase *tc_nohdr = tcase_create("Malloc without header");
+  tcase_add_test(tc_nohdr, test_memarena_malloc_nohdr);
+  suite_add_tcase(s, tc_nohdr);
+
   TCase *tc_realloc = tcase_create("Realloc");
   tcase_add_test(tc_realloc, test_memarena_realloc);
   suite_add_tcase(s, tc_realloc);
 
+  TCase *tc_remap = tcase_create("Realloc with mremap");
+  tcase_add_test(tc_remap, test_memarena_realloc_remap);
+  tcase_add_test(tc_remap, test_memarena_realloc_remap_arena_region);
+  suite_add_tcase(s, tc_remap);
+
   TCase *tc_memdup = tcase_create("Memdup");
   tcase_add_test(tc_memdup, test_memarena_memdup);
   suite_add_tcase(s, tc_memdup);
@@ -350,6 +1743,96 @@ Suite *test_memarena_suite(void) {
   tcase_add_test(tc_freereuse_bugr1, test_memarena_free_reuse_bug_region1);
   suite_add_tcase(s, tc_freereuse_bugr1);
 
+  TCase *tc_freemany = tcase_create("Free with many regions");
+  tcase_add_test(tc_freemany, test_memarena_free_many_regions);
+  suite_add_tcase(s, tc_freemany);
+
+  TCase *tc_spare = tcase_create("Spare region bins");
+  tcase_add_test(tc_spare, test_memarena_spare_bins);
+  suite_add_tcase(s, tc_spare);
+
+  TCase *tc_concurrent = tcase_create("Concurrent");
+  tcase_add_test(tc_concurrent, test_memarena_concurrent);
+  suite_add_tcase(s, tc_concurrent);
+
+  TCase *tc_scratch = tcase_create("Scratch");
+  tcase_add_test(tc_scratch, test_memarena_scratch);
+  suite_add_tcase(s, tc_scratch);
+
+  TCase *tc_cache = tcase_create("Region cache");
+  tcase_add_test(tc_cache, test_memarena_region_cache);
+  suite_add_tcase(s, tc_cache);
+
+  TCase *tc_hugepage = tcase_create("Huge page");
+  tcase_add_test(tc_hugepage, test_memarena_hugepage);
+  suite_add_tcase(s, tc_hugepage);
+
+  TCase *tc_trim = tcase_create("Reset trim");
+  tcase_add_test(tc_trim, test_memarena_reset_trim);
+  tcase_add_test(tc_trim, test_memarena_reset_trim_arena_region);
+  suite_add_tcase(s, tc_trim);
+
+  TCase *tc_growth = tcase_create("Growth policy");
+  tcase_add_test(tc_growth, test_memarena_growth);
+  suite_add_tcase(s, tc_growth);
+
+  TCase *tc_mark = tcase_create("Mark and rewind");
+  tcase_add_test(tc_mark, test_memarena_mark_rewind);
+  tcase_add_test(tc_mark, test_memarena_rewind_emptied_region);
+  suite_add_tcase(s, tc_mark);
+
+  TCase *tc_aligned = tcase_create("Aligned allocation");
+  tcase_add_test(tc_aligned, test_memarena_alloc_aligned);
+  suite_add_tcase(s, tc_aligned);
+
+  TCase *tc_inline = tcase_create("Inline allocation");
+  tcase_add_test(tc_inline, test_memarena_alloc_inline);
+  suite_add_tcase(s, tc_inline);
+
+  TCase *tc_vec = tcase_create("Vector");
+  tcase_add_test(tc_vec, test_memarena_vec);
+  suite_add_tcase(s, tc_vec);
+
+  TCase *tc_str = tcase_create("String builder");
+  tcase_add_test(tc_str, test_memarena_str);
+  suite_add_tcase(s, tc_str);
+
+  TCase *tc_intern = tcase_create("String interning");
+  tcase_add_test(tc_intern, test_memarena_intern);
+  suite_add_tcase(s, tc_intern);
+
+  TCase *tc_strndup = tcase_create("Bounded strndup");
+  tcase_add_test(tc_strndup, test_memarena_strndup_bounded);
+  tcase_add_test(tc_strndup, test_memarena_strndup_freelist);
+  suite_add_tcase(s, tc_strndup);
+
+  TCase *tc_freelist = tcase_create("Free lists");
+  tcase_add_test(tc_freelist, test_memarena_freelist);
+  suite_add_tcase(s, tc_freelist);
+
+  TCase *tc_pool = tcase_create("Object pool");
+  tcase_add_test(tc_pool, test_memarena_pool);
+  tcase_add_test(tc_pool, test_memarena_pool_threads);
+  tcase_add_test(tc_pool, test_memarena_pool_cache_slots);
+  tcase_add_test(tc_pool, test_memarena_pool_cache_destroyed);
+  suite_add_tcase(s, tc_pool);
+
+  TCase *tc_child = tcase_create("Child arena");
+  tcase_add_test(tc_child, test_memarena_child);
+  suite_add_tcase(s, tc_child);
+
+  TCase *tc_prefault = tcase_create("Prefault");
+  tcase_add_test(tc_prefault, test_memarena_prefault);
+  suite_add_tcase(s, tc_prefault);
+
+  TCase *tc_calloc = tcase_create("Calloc");
+  tcase_add_test(tc_calloc, test_memarena_calloc);
+  suite_add_tcase(s, tc_calloc);
+
+  TCase *tc_stats = tcase_create("Stats");
+  tcase_add_test(tc_stats, test_memarena_stats);
+  suite_add_tcase(s, tc_stats);
+
   TCase *tc_memsize = tcase_create("Memsize");
   tcase_add_test(tc_memsize, test_mem_memsize);
   suite_add_tcase(s, tc_memsize);
@@ -357,10 +1840,6 @@ Suite *test_memarena_suite(void) {
   TCase *tc_bigize = tcase_create("Bigsize");
   tcase_add_test(tc_memsize, test_bigsize_bug);
   suite_add_tcase(s, tc_bigize);
-
-  TCase *tc_perf = tcase_create("Performance");
-  tcase_add_test(tc_perf, test_performance);
-  suite_add_tcase(s, tc_perf);
   return s;
 }
 
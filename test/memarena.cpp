@@ -0,0 +1,158 @@
+#include "../src/include/memarena.hpp"
+#include <check.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory_resource>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* C++ adapters of memarena.hpp, the C API itself is tested by memarena.c */
+
+static std::size_t cached_regions() {
+  mem_region_cache_stats_t stats;
+  mem_region_cache_stats(&stats);
+  return stats.regions;
+}
+
+START_TEST(test_arena_move) {
+  /* destroyed regions land in the cache, that's how we see them go */
+  mem_region_cache_set_limit(64 * 1024 * 1024);
+  std::size_t cached = cached_regions();
+  {
+    memarena::arena a(getpagesize());
+    mem_arena_t *raw = a.get();
+    char *str = mem_strdup(a, "moved");
+    ck_assert_ptr_nonnull(str);
+
+    memarena::arena b(std::move(a));
+    ck_assert_ptr_null(a.get());
+    ck_assert_ptr_eq(b.get(), raw);
+    ck_assert_str_eq(str, "moved");
+
+    /* the arena it held is destroyed, the moved one is kept */
+    memarena::arena c(getpagesize());
+    c = std::move(b);
+    ck_assert_ptr_null(b.get());
+    ck_assert_ptr_eq(c.get(), raw);
+    ck_assert_uint_eq(cached_regions(), cached + 1);
+    ck_assert_str_eq(str, "moved");
+    /* moved from ones destroy nothing */
+  }
+  ck_assert_uint_eq(cached_regions(), cached + 2);
+  mem_region_cache_set_limit(0);
+}
+END_TEST
+
+START_TEST(test_savepoint) {
+  memarena::arena a(getpagesize());
+  char *keep = mem_strdup(a, "before");
+  mem_arena_region_t *tail = a.get()->tail;
+  std::size_t used = tail->used;
+  {
+    memarena::savepoint point(a);
+    for (int i = 0; i < 100; i++) {
+      ck_assert_ptr_nonnull(mem_alloc(a, getpagesize() / 2));
+    }
+    ck_assert_ptr_ne(a.get()->tail, tail);
+    point.rewind();
+    ck_assert_ptr_eq(a.get()->tail, tail);
+    ck_assert_uint_eq(tail->used, used);
+    ck_assert_ptr_nonnull(mem_alloc(a, getpagesize() * 4));
+  }
+  /* rewound on scope exit */
+  ck_assert_ptr_eq(a.get()->tail, tail);
+  ck_assert_uint_eq(tail->used, used);
+  ck_assert_str_eq(keep, "before");
+}
+END_TEST
+
+START_TEST(test_memory_resource) {
+  memarena::arena a(getpagesize());
+  memarena::memory_resource resource(a);
+
+  /* over-aligned goes through mem_alloc_aligned, its header is usable */
+  void *ptr = resource.allocate(100, 128);
+  ck_assert_uint_eq((std::uintptr_t)ptr % 128, 0);
+  ck_assert_uint_eq(mem_memsize(a, ptr), 100);
+  std::memset(ptr, 1, 100);
+  resource.deallocate(ptr, 100, 128);
+
+  ptr = resource.allocate(0, alignof(std::max_align_t));
+  ck_assert_ptr_nonnull(ptr);
+
+  memarena::memory_resource same(a);
+  memarena::arena b(getpagesize());
+  memarena::memory_resource other(b);
+  ck_assert(resource.is_equal(same));
+  ck_assert(!resource.is_equal(other));
+  ck_assert(!resource.is_equal(*std::pmr::new_delete_resource()));
+
+  std::pmr::vector<int> vec(&resource);
+  for (int i = 0; i < 1000; i++) {
+    vec.push_back(i);
+  }
+  ck_assert_int_eq(vec[999], 999);
+}
+END_TEST
+
+START_TEST(test_allocator) {
+  memarena::arena a(getpagesize());
+  memarena::arena b(getpagesize());
+  memarena::allocator<int> ints(a);
+  memarena::allocator<double> doubles(a);
+  memarena::allocator<int> others(b);
+
+  /* equal when on the same arena, whatever the type */
+  ck_assert(ints == doubles);
+  ck_assert(!(ints != doubles));
+  ck_assert(ints != others);
+  ck_assert(!(ints == others));
+
+  /* rebound one keeps the arena */
+  using rebound = std::allocator_traits<
+      memarena::allocator<int>>::rebind_alloc<long double>;
+  static_assert(std::is_same<rebound, memarena::allocator<long double>>::value,
+                "rebind");
+  rebound longs(ints);
+  ck_assert_ptr_eq(longs.get(), a.get());
+  ck_assert(longs == ints);
+  long double *ptr = longs.allocate(4);
+  ck_assert_uint_eq((std::uintptr_t)ptr % alignof(long double), 0);
+  ck_assert_uint_eq(mem_memsize(a, ptr), 4 * sizeof(long double));
+  longs.deallocate(ptr, 4);
+
+  std::vector<int, memarena::allocator<int>> vec(ints);
+  for (int i = 0; i < 1000; i++) {
+    vec.push_back(i);
+  }
+  ck_assert_int_eq(vec[999], 999);
+  ck_assert(vec.get_allocator() == ints);
+}
+END_TEST
+
+Suite *test_memarena_cpp_suite(void) {
+  Suite *s = suite_create("memarena.hpp");
+
+  TCase *tc_owners = tcase_create("RAII owners");
+  tcase_add_test(tc_owners, test_arena_move);
+  tcase_add_test(tc_owners, test_savepoint);
+  suite_add_tcase(s, tc_owners);
+
+  TCase *tc_alloc = tcase_create("Allocators");
+  tcase_add_test(tc_alloc, test_memory_resource);
+  tcase_add_test(tc_alloc, test_allocator);
+  suite_add_tcase(s, tc_alloc);
+  return s;
+}
+
+int main(void) {
+  SRunner *sr = srunner_create(test_memarena_cpp_suite());
+  srunner_set_fork_status(sr, CK_NOFORK);
+  srunner_run_all(sr, CK_VERBOSE);
+  int failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}